@@ -523,6 +523,20 @@ extern void (*_dma_cache_inv)(unsigned long start, unsigned long size);
 #define dma_cache_wback(start, size)		_dma_cache_wback(start, size)
 #define dma_cache_inv(start, size)		_dma_cache_inv(start, size)
 
+/*
+ * Same as the above but without waiting for the cache operations to
+ * complete, for syncing several ranges back to back. The caller must
+ * issue __sync() afterwards on the same CPU.
+ */
+extern void (*_dma_cache_wback_inv_nosync)(unsigned long start, unsigned long size);
+extern void (*_dma_cache_wback_nosync)(unsigned long start, unsigned long size);
+extern void (*_dma_cache_inv_nosync)(unsigned long start, unsigned long size);
+
+#define dma_cache_wback_inv_nosync(start, size)	\
+	_dma_cache_wback_inv_nosync(start, size)
+#define dma_cache_wback_nosync(start, size)	_dma_cache_wback_nosync(start, size)
+#define dma_cache_inv_nosync(start, size)	_dma_cache_inv_nosync(start, size)
+
 #else /* Sane hardware */
 
 #define dma_cache_wback_inv(start,size) \
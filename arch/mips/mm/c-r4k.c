@@ -19,7 +19,14 @@
 #include <linux/mm.h>
 #include <linux/export.h>
 #include <linux/bitops.h>
+#include <linux/debugfs.h>
 #include <linux/dma-map-ops.h> /* for dma_default_coherent */
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 
 #include <asm/bcache.h>
 #include <asm/bootinfo.h>
@@ -28,6 +35,7 @@
 #include <asm/cpu.h>
 #include <asm/cpu-features.h>
 #include <asm/cpu-type.h>
+#include <asm/debug.h>
 #include <asm/io.h>
 #include <asm/page.h>
 #include <asm/r4kcache.h>
@@ -745,7 +753,69 @@ static void r4k_flush_icache_user_range(unsigned long start, unsigned long end)
 
 #ifdef CONFIG_DMA_NONCOHERENT
 
-static void r4k_dma_cache_wback_inv(unsigned long addr, unsigned long size)
+/*
+ * Above this size the primary cache DMA ops flush the whole dcache with
+ * index ops instead of walking the buffer line by line. It starts out as
+ * the dcache size and r4k_dma_cache_calibrate() replaces it with the
+ * break even point measured at boot.
+ */
+static unsigned long dma_blast_size __read_mostly;
+
+enum r4k_dma_path {
+	R4K_DMA_WBACK_INV,
+	R4K_DMA_INV,
+	R4K_DMA_NR_PATHS,
+};
+
+#ifdef CONFIG_DEBUG_FS
+struct r4k_dma_stats {
+	unsigned long lines[R4K_DMA_NR_PATHS];
+	unsigned long blasts[R4K_DMA_NR_PATHS];
+};
+
+static DEFINE_PER_CPU(struct r4k_dma_stats, r4k_dma_stats);
+
+/* Counting is off until it is switched on in debugfs */
+static DEFINE_STATIC_KEY_FALSE(r4k_dma_stats_key);
+
+/* Called with preemption disabled */
+static inline void r4k_dma_count_lines(enum r4k_dma_path path,
+				       unsigned long addr, unsigned long size,
+				       unsigned long lsize)
+{
+	unsigned long lines;
+
+	if (!static_branch_unlikely(&r4k_dma_stats_key))
+		return;
+
+	lines = (ALIGN(addr + size, lsize) - ALIGN_DOWN(addr, lsize)) / lsize;
+	__this_cpu_add(r4k_dma_stats.lines[path], lines);
+}
+
+static inline void r4k_dma_count_blast(enum r4k_dma_path path)
+{
+	if (static_branch_unlikely(&r4k_dma_stats_key))
+		__this_cpu_inc(r4k_dma_stats.blasts[path]);
+}
+#else
+static inline void r4k_dma_count_lines(enum r4k_dma_path path,
+				       unsigned long addr, unsigned long size,
+				       unsigned long lsize)
+{
+}
+
+static inline void r4k_dma_count_blast(enum r4k_dma_path path)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
+/*
+ * The _nosync versions leave out the completion barrier so that
+ * dma_sync_phys() can issue a single one for all the pages of a
+ * segment.
+ */
+static void r4k_dma_cache_wback_inv_nosync(unsigned long addr,
+					   unsigned long size)
 {
 	/* Catch bad driver code */
 	if (WARN_ON(size == 0))
@@ -758,11 +828,13 @@ static void r4k_dma_cache_wback_inv(unsigned long addr, unsigned long size)
 				r4k_blast_scache();
 			else
 				r4k_blast_scache_node(pa_to_nid(addr));
+			r4k_dma_count_blast(R4K_DMA_WBACK_INV);
 		} else {
 			blast_scache_range(addr, addr + size);
+			r4k_dma_count_lines(R4K_DMA_WBACK_INV, addr, size,
+					    cpu_scache_line_size());
 		}
 		preempt_enable();
-		__sync();
 		return;
 	}
 
@@ -774,15 +846,23 @@ static void r4k_dma_cache_wback_inv(unsigned long addr, unsigned long size)
 	 * we have to use the HIT-type alternative as IPI cannot be used
 	 * here due to interrupts possibly being disabled.
 	 */
-	if (!r4k_op_needs_ipi(R4K_INDEX) && size >= dcache_size) {
+	if (!r4k_op_needs_ipi(R4K_INDEX) && size >= dma_blast_size) {
 		r4k_blast_dcache();
+		r4k_dma_count_blast(R4K_DMA_WBACK_INV);
 	} else {
 		R4600_HIT_CACHEOP_WAR_IMPL;
 		blast_dcache_range(addr, addr + size);
+		r4k_dma_count_lines(R4K_DMA_WBACK_INV, addr, size,
+				    cpu_dcache_line_size());
 	}
 	preempt_enable();
 
 	bc_wback_inv(addr, size);
+}
+
+static void r4k_dma_cache_wback_inv(unsigned long addr, unsigned long size)
+{
+	r4k_dma_cache_wback_inv_nosync(addr, size);
 	__sync();
 }
 
@@ -811,7 +891,7 @@ static void prefetch_cache_inv(unsigned long addr, unsigned long size)
 		protected_writeback_scache_line(addr0);
 }
 
-static void r4k_dma_cache_inv(unsigned long addr, unsigned long size)
+static void r4k_dma_cache_inv_nosync(unsigned long addr, unsigned long size)
 {
 	/* Catch bad driver code */
 	if (WARN_ON(size == 0))
@@ -828,6 +908,7 @@ static void r4k_dma_cache_inv(unsigned long addr, unsigned long size)
 				r4k_blast_scache();
 			else
 				r4k_blast_scache_node(pa_to_nid(addr));
+			r4k_dma_count_blast(R4K_DMA_INV);
 		} else {
 			/*
 			 * There is no clearly documented alignment requirement
@@ -838,23 +919,172 @@ static void r4k_dma_cache_inv(unsigned long addr, unsigned long size)
 			 * aligning the address to cache line size.
 			 */
 			blast_inv_scache_range(addr, addr + size);
+			r4k_dma_count_lines(R4K_DMA_INV, addr, size,
+					    cpu_scache_line_size());
 		}
 		preempt_enable();
-		__sync();
 		return;
 	}
 
-	if (!r4k_op_needs_ipi(R4K_INDEX) && size >= dcache_size) {
+	if (!r4k_op_needs_ipi(R4K_INDEX) && size >= dma_blast_size) {
 		r4k_blast_dcache();
+		r4k_dma_count_blast(R4K_DMA_INV);
 	} else {
 		R4600_HIT_CACHEOP_WAR_IMPL;
 		blast_inv_dcache_range(addr, addr + size);
+		r4k_dma_count_lines(R4K_DMA_INV, addr, size,
+				    cpu_dcache_line_size());
 	}
 	preempt_enable();
 
 	bc_inv(addr, size);
+}
+
+static void r4k_dma_cache_inv(unsigned long addr, unsigned long size)
+{
+	r4k_dma_cache_inv_nosync(addr, size);
 	__sync();
 }
+
+#define R4K_DMA_CALIBRATE_LOOPS	8
+
+/* Flush a dirty dcache sized buffer by either method, best of a few runs */
+static u64 __init r4k_dma_time_flush(void *buf, bool blast)
+{
+	unsigned long addr = (unsigned long)buf;
+	unsigned long flags;
+	u64 best = U64_MAX;
+	u64 start, t;
+	int i;
+
+	for (i = 0; i < R4K_DMA_CALIBRATE_LOOPS; i++) {
+		local_irq_save(flags);
+		memset(buf, i, dcache_size);
+
+		start = ktime_get_ns();
+		if (blast) {
+			r4k_blast_dcache();
+		} else {
+			R4600_HIT_CACHEOP_WAR_IMPL;
+			blast_dcache_range(addr, addr + dcache_size);
+		}
+		__sync();
+		t = ktime_get_ns() - start;
+		local_irq_restore(flags);
+
+		best = min(best, t);
+	}
+
+	return best;
+}
+
+/*
+ * The right crossover depends on the core, the cache geometry and how
+ * long the writebacks take on this memory bus, so rather than assuming
+ * it is the cache size time both ways of flushing a dirty dcache worth
+ * of data and scale. Clamped so a coarse clock can't give something
+ * silly.
+ */
+static void __init r4k_dma_cache_calibrate(void)
+{
+	u64 t_range, t_blast;
+	void *buf;
+
+	if (cpu_has_inclusive_pcaches || r4k_op_needs_ipi(R4K_INDEX) ||
+	    !dcache_size)
+		return;
+
+	buf = kmalloc(dcache_size, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	t_range = r4k_dma_time_flush(buf, false);
+	t_blast = r4k_dma_time_flush(buf, true);
+	kfree(buf);
+
+	if (!t_range || !t_blast)
+		return;
+
+	dma_blast_size = clamp_t(u64, div64_u64((u64)dcache_size * t_blast, t_range),
+				 dcache_size / 16, dcache_size * 4);
+
+	pr_info("DMA cache ops: whole dcache flush above %lu bytes (range %lluns, index %lluns)\n",
+		dma_blast_size, t_range, t_blast);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int r4k_dma_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const names[R4K_DMA_NR_PATHS] = {
+		[R4K_DMA_WBACK_INV] = "wback_inv",
+		[R4K_DMA_INV] = "inv",
+	};
+	unsigned long lines, blasts;
+	int path, cpu;
+
+	for (path = 0; path < R4K_DMA_NR_PATHS; path++) {
+		lines = 0;
+		blasts = 0;
+
+		for_each_possible_cpu(cpu) {
+			struct r4k_dma_stats *stats = per_cpu_ptr(&r4k_dma_stats, cpu);
+
+			lines += READ_ONCE(stats->lines[path]);
+			blasts += READ_ONCE(stats->blasts[path]);
+		}
+
+		seq_printf(s, "%s lines: %lu\n", names[path], lines);
+		seq_printf(s, "%s whole cache: %lu\n", names[path], blasts);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(r4k_dma_stats);
+
+static int r4k_dma_stats_enable_get(void *data, u64 *val)
+{
+	*val = static_key_enabled(&r4k_dma_stats_key);
+	return 0;
+}
+
+static int r4k_dma_stats_enable_set(void *data, u64 val)
+{
+	if (val)
+		static_branch_enable(&r4k_dma_stats_key);
+	else
+		static_branch_disable(&r4k_dma_stats_key);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(r4k_dma_stats_enable_fops, r4k_dma_stats_enable_get,
+			 r4k_dma_stats_enable_set, "%llu\n");
+
+static void __init r4k_dma_cache_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("dma_cache", mips_debugfs_dir);
+	debugfs_create_ulong("blast_size", 0644, dir, &dma_blast_size);
+	debugfs_create_file("stats", 0444, dir, NULL, &r4k_dma_stats_fops);
+	debugfs_create_file_unsafe("stats_enable", 0644, dir, NULL,
+				   &r4k_dma_stats_enable_fops);
+}
+#else
+static inline void r4k_dma_cache_debugfs_init(void)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
+static int __init r4k_dma_cache_init(void)
+{
+	if (!cpu_has_4k_cache || dma_default_coherent)
+		return 0;
+
+	r4k_dma_cache_calibrate();
+	r4k_dma_cache_debugfs_init();
+
+	return 0;
+}
+late_initcall(r4k_dma_cache_init);
 #endif /* CONFIG_DMA_NONCOHERENT */
 
 static void r4k_flush_icache_all(void)
@@ -1756,6 +1986,10 @@ void r4k_cache_init(void)
 	_dma_cache_wback_inv	= r4k_dma_cache_wback_inv;
 	_dma_cache_wback	= r4k_dma_cache_wback_inv;
 	_dma_cache_inv		= r4k_dma_cache_inv;
+	_dma_cache_wback_inv_nosync	= r4k_dma_cache_wback_inv_nosync;
+	_dma_cache_wback_nosync	= r4k_dma_cache_wback_inv_nosync;
+	_dma_cache_inv_nosync	= r4k_dma_cache_inv_nosync;
+	dma_blast_size		= dcache_size;
 #endif /* CONFIG_DMA_NONCOHERENT */
 
 	build_clear_page();
@@ -79,6 +79,9 @@ struct bcache_ops *bcops = &no_sc_ops;
 void (*_dma_cache_wback_inv)(unsigned long start, unsigned long size);
 void (*_dma_cache_wback)(unsigned long start, unsigned long size);
 void (*_dma_cache_inv)(unsigned long start, unsigned long size);
+void (*_dma_cache_wback_inv_nosync)(unsigned long start, unsigned long size);
+void (*_dma_cache_wback_nosync)(unsigned long start, unsigned long size);
+void (*_dma_cache_inv_nosync)(unsigned long start, unsigned long size);
 
 #endif /* CONFIG_DMA_NONCOHERENT */
 
@@ -222,5 +225,15 @@ void cpu_cache_init(void)
 		octeon_cache_init();
 	}
 
+#ifdef CONFIG_DMA_NONCOHERENT
+	/* Cache code without batching support just syncs every time */
+	if (!_dma_cache_wback_inv_nosync)
+		_dma_cache_wback_inv_nosync = _dma_cache_wback_inv;
+	if (!_dma_cache_wback_nosync)
+		_dma_cache_wback_nosync = _dma_cache_wback;
+	if (!_dma_cache_inv_nosync)
+		_dma_cache_inv_nosync = _dma_cache_inv;
+#endif
+
 	setup_protection_map();
 }
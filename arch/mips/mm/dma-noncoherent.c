@@ -54,18 +54,22 @@ void *arch_dma_set_uncached(void *addr, size_t size)
 	return (void *)(__pa(addr) + UNCAC_BASE);
 }
 
+/*
+ * The cache ops below don't wait for completion, the callers of
+ * dma_sync_phys() issue one barrier once everything has been queued.
+ */
 static inline void dma_sync_virt_for_device(void *addr, size_t size,
 		enum dma_data_direction dir)
 {
 	switch (dir) {
 	case DMA_TO_DEVICE:
-		dma_cache_wback((unsigned long)addr, size);
+		dma_cache_wback_nosync((unsigned long)addr, size);
 		break;
 	case DMA_FROM_DEVICE:
-		dma_cache_inv((unsigned long)addr, size);
+		dma_cache_inv_nosync((unsigned long)addr, size);
 		break;
 	case DMA_BIDIRECTIONAL:
-		dma_cache_wback_inv((unsigned long)addr, size);
+		dma_cache_wback_inv_nosync((unsigned long)addr, size);
 		break;
 	default:
 		BUG();
@@ -80,7 +84,7 @@ static inline void dma_sync_virt_for_cpu(void *addr, size_t size,
 		break;
 	case DMA_FROM_DEVICE:
 	case DMA_BIDIRECTIONAL:
-		dma_cache_inv((unsigned long)addr, size);
+		dma_cache_inv_nosync((unsigned long)addr, size);
 		break;
 	default:
 		BUG();
@@ -91,6 +95,8 @@ static inline void dma_sync_virt_for_cpu(void *addr, size_t size,
  * A single sg entry may refer to multiple physically contiguous pages.  But
  * we still need to process highmem pages individually.  If highmem is not
  * configured then the bulk of this loop gets optimized out.
+ *
+ * Must be called with preemption disabled and followed by __sync().
  */
 static inline void dma_sync_phys(phys_addr_t paddr, size_t size,
 		enum dma_data_direction dir, bool for_device)
@@ -124,15 +130,23 @@ static inline void dma_sync_phys(phys_addr_t paddr, size_t size,
 void arch_sync_dma_for_device(phys_addr_t paddr, size_t size,
 		enum dma_data_direction dir)
 {
+	preempt_disable();
 	dma_sync_phys(paddr, size, dir, true);
+	__sync();
+	preempt_enable();
 }
 
 #ifdef CONFIG_ARCH_HAS_SYNC_DMA_FOR_CPU
 void arch_sync_dma_for_cpu(phys_addr_t paddr, size_t size,
 		enum dma_data_direction dir)
 {
-	if (cpu_needs_post_dma_flush())
-		dma_sync_phys(paddr, size, dir, false);
+	if (!cpu_needs_post_dma_flush())
+		return;
+
+	preempt_disable();
+	dma_sync_phys(paddr, size, dir, false);
+	__sync();
+	preempt_enable();
 }
 #endif
 
@@ -936,6 +936,68 @@ static void cache_range_window_reg(struct kunit *test)
 	KUNIT_ASSERT_EQ(test, val, 2);
 }
 
+static void field_batch(struct kunit *test)
+{
+	struct regcache_types *t = (struct regcache_types *)test->param_value;
+	struct regmap *map;
+	struct regmap_config config;
+	struct regmap_ram_data *data;
+	struct regmap_field *lo, *hi, *whole;
+	struct regmap_field_batch batch;
+	unsigned int val, rval;
+	bool change;
+	int i;
+
+	config = test_regmap_config;
+	config.cache_type = t->type;
+
+	map = gen_regmap(&config, &data);
+	KUNIT_ASSERT_FALSE(test, IS_ERR(map));
+	if (IS_ERR(map))
+		return;
+
+	lo = regmap_field_alloc(map, (struct reg_field)REG_FIELD(0, 0, 7));
+	hi = regmap_field_alloc(map, (struct reg_field)REG_FIELD(0, 8, 15));
+	whole = regmap_field_alloc(map, (struct reg_field)REG_FIELD(1, 0, 31));
+	KUNIT_ASSERT_FALSE(test, IS_ERR(lo) || IS_ERR(hi) || IS_ERR(whole));
+
+	KUNIT_EXPECT_EQ(test, 0, regmap_write(map, 0, 0));
+	for (i = 0; i < BLOCK_TEST_SIZE; i++)
+		data->written[i] = false;
+
+	get_random_bytes(&val, sizeof(val));
+
+	regmap_field_batch_init(&batch, map);
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_write(&batch, lo, 0x12));
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_write(&batch, hi, 0xff));
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_write(&batch, hi, 0x34));
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_write(&batch, whole, val));
+
+	/* Nothing hits the hardware until the flush */
+	KUNIT_EXPECT_FALSE(test, data->written[0]);
+	KUNIT_EXPECT_FALSE(test, data->written[1]);
+
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_flush(&batch, &change));
+	KUNIT_EXPECT_TRUE(test, change);
+	KUNIT_EXPECT_EQ(test, 0x3412, data->vals[0]);
+	KUNIT_EXPECT_EQ(test, val, data->vals[1]);
+
+	/* Writing the same values again shouldn't change anything */
+	data->written[0] = false;
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_write(&batch, lo, 0x12));
+	KUNIT_EXPECT_EQ(test, 0, regmap_field_batch_flush(&batch, &change));
+	KUNIT_EXPECT_FALSE(test, change);
+	KUNIT_EXPECT_FALSE(test, data->written[0]);
+
+	KUNIT_EXPECT_EQ(test, 0, regmap_read(map, 0, &rval));
+	KUNIT_EXPECT_EQ(test, 0x3412, rval);
+
+	regmap_field_free(whole);
+	regmap_field_free(hi);
+	regmap_field_free(lo);
+	regmap_exit(map);
+}
+
 struct raw_test_types {
 	const char *name;
 
@@ -1279,6 +1341,7 @@ static struct kunit_case regmap_test_cases[] = {
 	KUNIT_CASE_PARAM(cache_drop, sparse_cache_types_gen_params),
 	KUNIT_CASE_PARAM(cache_present, sparse_cache_types_gen_params),
 	KUNIT_CASE_PARAM(cache_range_window_reg, real_cache_types_gen_params),
+	KUNIT_CASE_PARAM(field_batch, regcache_types_gen_params),
 
 	KUNIT_CASE_PARAM(raw_read_defaults_single, raw_test_types_gen_params),
 	KUNIT_CASE_PARAM(raw_read_defaults, raw_test_types_gen_params),
@@ -2256,6 +2256,135 @@ int regmap_field_test_bits(struct regmap_field *field, unsigned int bits)
 }
 EXPORT_SYMBOL_GPL(regmap_field_test_bits);
 
+/**
+ * regmap_field_batch_init() - Start collecting field updates
+ *
+ * @batch: Batch to initialise
+ * @map: Register map the fields that will be added belong to
+ */
+void regmap_field_batch_init(struct regmap_field_batch *batch,
+			     struct regmap *map)
+{
+	batch->map = map;
+	batch->num = 0;
+	batch->change = false;
+}
+EXPORT_SYMBOL_GPL(regmap_field_batch_init);
+
+/**
+ * regmap_field_batch_update_bits() - Add a field update to a batch
+ *
+ * @batch: Batch to add the update to
+ * @field: Register field to update
+ * @mask: Bitmask to change
+ * @val: Value to be written
+ *
+ * Nothing is written until regmap_field_batch_flush() is called, apart
+ * from when the batch is already full of updates to other registers in
+ * which case the pending updates are flushed first. Updates to fields
+ * in the same register are merged with later updates taking priority.
+ *
+ * A value of zero will be returned on success, a negative errno will
+ * be returned in error cases.
+ */
+int regmap_field_batch_update_bits(struct regmap_field_batch *batch,
+				   struct regmap_field *field,
+				   unsigned int mask, unsigned int val)
+{
+	unsigned int i;
+	int ret;
+
+	if (field->regmap != batch->map)
+		return -EINVAL;
+
+	mask = (mask << field->shift) & field->mask;
+	val <<= field->shift;
+
+	for (i = 0; i < batch->num; i++) {
+		if (batch->updates[i].reg == field->reg)
+			goto merge;
+	}
+
+	if (batch->num == ARRAY_SIZE(batch->updates)) {
+		bool change;
+
+		/* Hang on to the change for the caller's flush */
+		ret = regmap_field_batch_flush(batch, &change);
+		batch->change = change;
+		if (ret)
+			return ret;
+		i = 0;
+	}
+
+	batch->updates[i].reg = field->reg;
+	batch->updates[i].mask = 0;
+	batch->updates[i].val = 0;
+	batch->num++;
+
+merge:
+	batch->updates[i].val &= ~mask;
+	batch->updates[i].val |= val & mask;
+	batch->updates[i].mask |= mask;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(regmap_field_batch_update_bits);
+
+/**
+ * regmap_field_batch_flush() - Write out the updates collected in a batch
+ *
+ * @batch: Batch to flush
+ * @change: Boolean indicating if a write was done, including any done
+ *          because the batch filled up since it was last reported
+ *
+ * The lock is taken once for all of the registers. A register that is
+ * being completely overwritten on a map without a cache is written
+ * without reading it first, otherwise this is a read/modify/write that
+ * is skipped if nothing changed like regmap_update_bits().
+ *
+ * A value of zero will be returned on success, a negative errno will
+ * be returned in error cases.
+ */
+int regmap_field_batch_flush(struct regmap_field_batch *batch, bool *change)
+{
+	struct regmap *map = batch->map;
+	unsigned int full = GENMASK(map->format.val_bytes * BITS_PER_BYTE - 1, 0);
+	unsigned int i;
+	bool changed;
+	int ret = 0;
+
+	map->lock(map->lock_arg);
+
+	for (i = 0; i < batch->num; i++) {
+		unsigned int reg = batch->updates[i].reg;
+		unsigned int mask = batch->updates[i].mask;
+		unsigned int val = batch->updates[i].val;
+
+		if (map->cache_type == REGCACHE_NONE && (mask & full) == full) {
+			ret = _regmap_write(map, reg, val);
+			changed = !ret;
+		} else {
+			ret = _regmap_update_bits(map, reg, mask, val, &changed, false);
+		}
+
+		if (ret)
+			break;
+
+		batch->change |= changed;
+	}
+
+	map->unlock(map->lock_arg);
+
+	batch->num = 0;
+
+	if (change)
+		*change = batch->change;
+	batch->change = false;
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(regmap_field_batch_flush);
+
 /**
  * regmap_fields_update_bits_base() - Perform a read/modify/write cycle a
  *                                    register field with port ID
@@ -5,17 +5,31 @@
 
 #include <linux/hw_random.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
 #include <linux/module.h>
 #include <linux/of_address.h>
 #include <linux/of_platform.h>
 #include <linux/slab.h>
 #include <linux/regmap.h>
 #include <linux/clk.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #define REG_CTRL	0x0
 #define REG_VALUE	0x8
 #define REG_STATUS	0xc
 
+/*
+ * Words are pulled out of the generator by a worker into a small pool
+ * and reads are served from that. If the generator isn't ready the
+ * worker waits a little bit for it and then comes back later instead
+ * of spinning.
+ */
+#define MSC313_RNG_POOL_SIZE		512
+#define MSC313_RNG_READY_TIMEOUT_US	20
+#define MSC313_RNG_REFILL_DELAY		1
+#define MSC313_RNG_READ_TIMEOUT		HZ
+
 static const struct reg_field ctrl_enable = REG_FIELD(REG_CTRL, 7, 7);
 static const struct reg_field status_ready = REG_FIELD(REG_STATUS, 0, 0);
 
@@ -25,30 +39,124 @@ struct msc313_rng {
 	struct clk *clk;
 	struct regmap_field *enable;
 	struct regmap_field *ready;
+
+	/* Only the worker puts into the pool and only read() takes out */
+	DECLARE_KFIFO(pool, u8, MSC313_RNG_POOL_SIZE);
+	struct delayed_work refill;
+	wait_queue_head_t pool_wait;
+
+	/* stats */
+	atomic64_t bytes_generated;
+	atomic64_t bytes_served;
+	atomic64_t not_ready;
+	atomic64_t refill_ns;
 };
 
-static int msc313_rng_read(struct hwrng *hwrng, void *data, size_t max, bool wait)
+static void msc313_rng_refill(struct work_struct *work)
 {
-	struct msc313_rng *rng = container_of(hwrng, struct msc313_rng, hwrng);
+	struct msc313_rng *rng = container_of(to_delayed_work(work), struct msc313_rng, refill);
+	ktime_t start = ktime_get();
 	unsigned int value;
-	int i, ret = 0;
+	u8 word[2];
 
-	while (ret < max) {
-		if (regmap_field_read_poll_timeout(rng->ready, value, value == 1, 0, 1000000)) {
-			pr_warn("timeout waiting for rdy\n");
-			goto out;
+	while (kfifo_avail(&rng->pool) >= sizeof(word)) {
+		if (regmap_field_read_poll_timeout(rng->ready, value, value == 1, 0,
+						   MSC313_RNG_READY_TIMEOUT_US)) {
+			atomic64_inc(&rng->not_ready);
+			break;
 		}
+
 		regmap_read(rng->regmap, REG_VALUE, &value);
-		for (i = 0; i < 2 && ret < max; i++) {
-			*((u8*)(data) + ret) = value >> (8 * i);
-			ret += 1;
-		}
+		word[0] = value;
+		word[1] = value >> 8;
+		kfifo_in(&rng->pool, word, sizeof(word));
+		atomic64_add(sizeof(word), &rng->bytes_generated);
 	}
 
-out:
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)), &rng->refill_ns);
+
+	if (!kfifo_is_empty(&rng->pool))
+		wake_up(&rng->pool_wait);
+
+	/* Generator wasn't ready, try again later */
+	if (kfifo_avail(&rng->pool) >= sizeof(word))
+		schedule_delayed_work(&rng->refill, MSC313_RNG_REFILL_DELAY);
+}
+
+static int msc313_rng_read(struct hwrng *hwrng, void *data, size_t max, bool wait)
+{
+	struct msc313_rng *rng = container_of(hwrng, struct msc313_rng, hwrng);
+	unsigned int ret;
+
+	if (kfifo_is_empty(&rng->pool)) {
+		if (!wait)
+			return 0;
+
+		mod_delayed_work(system_wq, &rng->refill, 0);
+		if (!wait_event_timeout(rng->pool_wait, !kfifo_is_empty(&rng->pool),
+					MSC313_RNG_READ_TIMEOUT))
+			return -ETIMEDOUT;
+	}
+
+	ret = kfifo_out(&rng->pool, data, max);
+	atomic64_add(ret, &rng->bytes_served);
+
+	/* Top the pool back up now there is space */
+	mod_delayed_work(system_wq, &rng->refill, 0);
+
 	return ret;
 }
 
+static ssize_t bytes_generated_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct msc313_rng *rng = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n", atomic64_read(&rng->bytes_generated));
+}
+static DEVICE_ATTR_RO(bytes_generated);
+
+static ssize_t bytes_served_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct msc313_rng *rng = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n", atomic64_read(&rng->bytes_served));
+}
+static DEVICE_ATTR_RO(bytes_served);
+
+static ssize_t not_ready_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct msc313_rng *rng = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n", atomic64_read(&rng->not_ready));
+}
+static DEVICE_ATTR_RO(not_ready);
+
+/* Time spent pulling words out of the generator, i.e. the CPU cost */
+static ssize_t refill_time_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct msc313_rng *rng = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n", div_s64(atomic64_read(&rng->refill_ns), NSEC_PER_USEC));
+}
+static DEVICE_ATTR_RO(refill_time_us);
+
+static struct attribute *msc313_rng_attrs[] = {
+	&dev_attr_bytes_generated.attr,
+	&dev_attr_bytes_served.attr,
+	&dev_attr_not_ready.attr,
+	&dev_attr_refill_time_us.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(msc313_rng);
+
+static void msc313_rng_stop(void *data)
+{
+	struct msc313_rng *rng = data;
+
+	cancel_delayed_work_sync(&rng->refill);
+	regmap_field_write(rng->enable, 0);
+}
+
 static const struct regmap_config msc313_rng_regmap_config = {
 	.reg_bits = 16,
 	.val_bits = 16,
@@ -92,8 +200,20 @@ static int msc313_rng_probe(struct platform_device *pdev)
 	rng->enable = devm_regmap_field_alloc(dev, rng->regmap, ctrl_enable);
 	rng->ready = devm_regmap_field_alloc(dev, rng->regmap, status_ready);
 
+	INIT_KFIFO(rng->pool);
+	INIT_DELAYED_WORK(&rng->refill, msc313_rng_refill);
+	init_waitqueue_head(&rng->pool_wait);
+	platform_set_drvdata(pdev, rng);
+
 	regmap_field_write(rng->enable, 1);
 
+	ret = devm_add_action_or_reset(dev, msc313_rng_stop, rng);
+	if (ret)
+		goto out;
+
+	/* Have something ready for the first reader */
+	schedule_delayed_work(&rng->refill, 0);
+
 	rng->hwrng.name = dev_driver_string(dev),
 	rng->hwrng.read = msc313_rng_read,
 	rng->hwrng.quality = 0;
@@ -115,6 +235,7 @@ static struct platform_driver msc313_rng_driver = {
 	.driver = {
 		.name = "msc313-rng",
 		.of_match_table = msc313_rng_match,
+		.dev_groups = msc313_rng_groups,
 	},
 	.probe = msc313_rng_probe,
 };
@@ -75,17 +75,25 @@ static void msc313e_timer_setup(void __iomem *base, unsigned long delay)
 	local_irq_restore(flags);
 }
 
-static unsigned long msc313e_timer_current_value(void __iomem *base)
+/*
+ * The counter is split over two 16 bit registers so the low half can
+ * wrap between reading it and the high half. Read high, low, high and
+ * go around again if the high half moved. This is safe from any
+ * context without turning interrupts off and nothing in here needs
+ * the barriers readw() brings along.
+ */
+static notrace u32 msc313e_timer_current_value(void __iomem *base)
 {
-	unsigned long flags;
-	u16 l, h;
+	u16 l, h, prev;
 
-	local_irq_save(flags);
-	l = readw(base + MSC313E_REG_COUNTER_LOW);
-	h = readw(base + MSC313E_REG_COUNTER_HIGH);
-	local_irq_restore(flags);
+	h = readw_relaxed(base + MSC313E_REG_COUNTER_HIGH);
+	do {
+		prev = h;
+		l = readw_relaxed(base + MSC313E_REG_COUNTER_LOW);
+		h = readw_relaxed(base + MSC313E_REG_COUNTER_HIGH);
+	} while (unlikely(h != prev));
 
-	return (((u32)h) << 16 | l);
+	return ((u32)h) << 16 | l;
 }
 
 static int msc313e_timer_clkevt_shutdown(struct clock_event_device *evt)
@@ -150,7 +158,7 @@ static unsigned long msc313e_read_delay_timer_read(void)
 }
 #endif
 
-static u64 msc313e_timer_sched_clock_read(void)
+static u64 notrace msc313e_timer_sched_clock_read(void)
 {
 	return msc313e_timer_current_value(msc313e_clksrc);
 }
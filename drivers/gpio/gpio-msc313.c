@@ -546,61 +546,82 @@ static unsigned ssc8336_offsets[] = {
 MSC313_GPIO_CHIPDATA(ssc8336, msc313_gpio_populate_parent_fwspec, msc313e_gpio_child_to_parent_hwirq);
 #endif
 
+/*
+ * Each pin has its own register so there is nothing to gain from
+ * batching pins up but a register is shared by the output and the
+ * direction bits. A lock per pin stops a set and a direction change
+ * on the same pin from stomping on each other without pins on
+ * different buses getting in each other's way.
+ */
 struct msc313_gpio {
-	spinlock_t lock;
+	spinlock_t *locks;
 	void __iomem *base;
 	const struct msc313_gpio_data *gpio_data;
 	u8 *saved;
 };
 
-static void msc313_gpio_set(struct gpio_chip *chip, unsigned int offset, int value)
+static void msc313_gpio_rmw(struct msc313_gpio *gpio, unsigned int offset, u8 mask, u8 val)
 {
-	struct msc313_gpio *gpio = gpiochip_get_data(chip);
+	void __iomem *reg = gpio->base + gpio->gpio_data->offsets[offset];
 	unsigned long flags;
 	u8 gpioreg;
 
-	spin_lock_irqsave(&gpio->lock, flags);
-
-	gpioreg = readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]);
-	if (value)
-		gpioreg |= MSC313_GPIO_OUT;
-	else
-		gpioreg &= ~MSC313_GPIO_OUT;
+	spin_lock_irqsave(&gpio->locks[offset], flags);
 
-	writeb_relaxed(gpioreg, gpio->base + gpio->gpio_data->offsets[offset]);
+	gpioreg = readb_relaxed(reg);
+	gpioreg &= ~mask;
+	gpioreg |= val;
+	writeb_relaxed(gpioreg, reg);
 
-	spin_unlock_irqrestore(&gpio->lock, flags);
+	spin_unlock_irqrestore(&gpio->locks[offset], flags);
 }
 
-static int msc313_gpio_get(struct gpio_chip *chip, unsigned int offset)
+static void msc313_gpio_set(struct gpio_chip *chip, unsigned int offset, int value)
 {
 	struct msc313_gpio *gpio = gpiochip_get_data(chip);
-	unsigned long flags;
-	u8 gpioreg;
 
-	spin_lock_irqsave(&gpio->lock, flags);
+	msc313_gpio_rmw(gpio, offset, MSC313_GPIO_OUT, value ? MSC313_GPIO_OUT : 0);
+}
 
-	gpioreg = readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]);
+static void msc313_gpio_set_multiple(struct gpio_chip *chip, unsigned long *mask,
+				     unsigned long *bits)
+{
+	struct msc313_gpio *gpio = gpiochip_get_data(chip);
+	unsigned int offset;
 
-	spin_unlock_irqrestore(&gpio->lock, flags);
+	for_each_set_bit(offset, mask, chip->ngpio)
+		msc313_gpio_rmw(gpio, offset, MSC313_GPIO_OUT,
+				test_bit(offset, bits) ? MSC313_GPIO_OUT : 0);
+}
 
-	return gpioreg & MSC313_GPIO_IN;
+/* A single byte read can't tear so there's no need to lock here */
+static int msc313_gpio_get(struct gpio_chip *chip, unsigned int offset)
+{
+	struct msc313_gpio *gpio = gpiochip_get_data(chip);
+
+	return readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]) & MSC313_GPIO_IN;
 }
 
-static int msc313_gpio_direction_input(struct gpio_chip *chip, unsigned int offset)
+static int msc313_gpio_get_multiple(struct gpio_chip *chip, unsigned long *mask,
+				    unsigned long *bits)
 {
 	struct msc313_gpio *gpio = gpiochip_get_data(chip);
-	unsigned long flags;
+	unsigned int offset;
 	u8 gpioreg;
 
-	spin_lock_irqsave(&gpio->lock, flags);
+	for_each_set_bit(offset, mask, chip->ngpio) {
+		gpioreg = readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]);
+		__assign_bit(offset, bits, gpioreg & MSC313_GPIO_IN);
+	}
 
-	gpioreg = readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]);
-	gpioreg |= MSC313_GPIO_OEN;
+	return 0;
+}
 
-	writeb_relaxed(gpioreg, gpio->base + gpio->gpio_data->offsets[offset]);
+static int msc313_gpio_direction_input(struct gpio_chip *chip, unsigned int offset)
+{
+	struct msc313_gpio *gpio = gpiochip_get_data(chip);
 
-	spin_unlock_irqrestore(&gpio->lock, flags);
+	msc313_gpio_rmw(gpio, offset, MSC313_GPIO_OEN, MSC313_GPIO_OEN);
 
 	return 0;
 }
@@ -608,21 +629,9 @@ static int msc313_gpio_direction_input(struct gpio_chip *chip, unsigned int offs
 static int msc313_gpio_direction_output(struct gpio_chip *chip, unsigned int offset, int value)
 {
 	struct msc313_gpio *gpio = gpiochip_get_data(chip);
-	unsigned long flags;
-	u8 gpioreg;
 
-	spin_lock_irqsave(&gpio->lock, flags);
-
-	gpioreg = readb_relaxed(gpio->base + gpio->gpio_data->offsets[offset]);
-	gpioreg &= ~MSC313_GPIO_OEN;
-	if (value)
-		gpioreg |= MSC313_GPIO_OUT;
-	else
-		gpioreg &= ~MSC313_GPIO_OUT;
-
-	writeb_relaxed(gpioreg, gpio->base + gpio->gpio_data->offsets[offset]);
-
-	spin_unlock_irqrestore(&gpio->lock, flags);
+	msc313_gpio_rmw(gpio, offset, MSC313_GPIO_OEN | MSC313_GPIO_OUT,
+			value ? MSC313_GPIO_OUT : 0);
 
 	return 0;
 }
@@ -745,6 +754,7 @@ static int msc313_gpio_probe(struct platform_device *pdev)
 	struct irq_domain *parent_domain;
 	struct device_node *parent_node;
 	struct device *dev = &pdev->dev;
+	int i;
 
 	match_data = of_device_get_match_data(dev);
 	if (!match_data)
@@ -762,10 +772,15 @@ static int msc313_gpio_probe(struct platform_device *pdev)
 	if (!gpio)
 		return -ENOMEM;
 
-	spin_lock_init(&gpio->lock);
-
 	gpio->gpio_data = match_data;
 
+	gpio->locks = devm_kcalloc(dev, gpio->gpio_data->num, sizeof(*gpio->locks), GFP_KERNEL);
+	if (!gpio->locks)
+		return -ENOMEM;
+
+	for (i = 0; i < gpio->gpio_data->num; i++)
+		spin_lock_init(&gpio->locks[i]);
+
 	gpio->saved = devm_kcalloc(dev, gpio->gpio_data->num, sizeof(*gpio->saved), GFP_KERNEL);
 	if (!gpio->saved)
 		return -ENOMEM;
@@ -787,7 +802,9 @@ static int msc313_gpio_probe(struct platform_device *pdev)
 	gpiochip->direction_input = msc313_gpio_direction_input;
 	gpiochip->direction_output = msc313_gpio_direction_output;
 	gpiochip->get = msc313_gpio_get;
+	gpiochip->get_multiple = msc313_gpio_get_multiple;
 	gpiochip->set = msc313_gpio_set;
+	gpiochip->set_multiple = msc313_gpio_set_multiple;
 	gpiochip->base = -1;
 	gpiochip->ngpio = gpio->gpio_data->num;
 	gpiochip->names = gpio->gpio_data->names;
@@ -3,11 +3,26 @@
 #ifndef _MSTAR_DRM_H_
 #define _MSTAR_MSTAR_DRM_H_
 
+#include <linux/atomic.h>
+#include <linux/list.h>
+
+struct mstar_ge;
 struct mstar_top;
 
 struct mstar_drv {
 	struct device *dev;
+	struct drm_device *drm;
 	struct mstar_top* top;
+
+	/* GOPs, their register updates get committed from the crtc flush */
+	struct list_head gops;
+	/* same for the MOPs */
+	struct list_head mops;
+
+	/* optional, used to accelerate fbdev */
+	struct mstar_ge *ge;
+	atomic64_t fbdev_ge_pixels;
+	atomic64_t fbdev_cpu_pixels;
 };
 
 #endif /* _MSTAR_DRM_H_ */
@@ -11,7 +11,6 @@
 
 #include <drm/drm_atomic_helper.h>
 #include <drm/drm_drv.h>
-#include <drm/drm_fbdev_generic.h>
 #include <drm/drm_fb_dma_helper.h>
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_gem_dma_helper.h>
@@ -20,7 +19,9 @@
 #include <drm/drm_vblank.h>
 
 #include "mstar_drm.h"
+#include "mstar_fbdev.h"
 #include "mstar_framebuffer.h"
+#include "mstar_ge.h"
 
 #define DRIVER_NAME "mstar-drm"
 
@@ -44,24 +45,45 @@ static const struct drm_mode_config_funcs drv_mode_config_funcs = {
 	.atomic_commit = drm_atomic_helper_commit,
 };
 
+/*
+ * The plane registers are double buffered and get latched at vblank.
+ * The crtc flush arms the vblank event so the commit is finished when
+ * the vblank interrupt sends it, waiting for flip done instead of a
+ * full vblank lets non-blocking commits queue up behind each other.
+ */
+static void mstar_drv_commit_tail(struct drm_atomic_state *old_state)
+{
+	struct drm_device *drm = old_state->dev;
+
+	drm_atomic_helper_commit_modeset_disables(drm, old_state);
+	drm_atomic_helper_commit_modeset_enables(drm, old_state);
+	drm_atomic_helper_commit_planes(drm, old_state, 0);
+
+	drm_atomic_helper_commit_hw_done(old_state);
+
+	drm_atomic_helper_wait_for_flip_done(drm, old_state);
+
+	drm_atomic_helper_cleanup_planes(drm, old_state);
+}
+
+static const struct drm_mode_config_helper_funcs drv_mode_config_helpers = {
+	.atomic_commit_tail = mstar_drv_commit_tail,
+};
+
 static int mstar_drv_bind(struct device *dev)
 {
+	struct mstar_drv *drv = dev_get_drvdata(dev);
 	struct drm_device *drm;
-	struct mstar_drv *drv;
 	int ret;
 
 	drm = drm_dev_alloc(&mstar_drv_driver, dev);
 	if (IS_ERR(drm))
 		return PTR_ERR(drm);
 
-	drv = devm_kzalloc(dev, sizeof(*drv), GFP_KERNEL);
-	if (!drv) {
-		ret = -ENOMEM;
-		goto free_drm;
-	}
-
-	dev_set_drvdata(dev, drm);
+	drv->drm = drm;
 	drm->dev_private = drv;
+	INIT_LIST_HEAD(&drv->gops);
+	INIT_LIST_HEAD(&drv->mops);
 
 	ret = of_reserved_mem_device_init(dev);
 	if (ret && ret != -ENODEV) {
@@ -76,6 +98,7 @@ static int mstar_drv_bind(struct device *dev)
 	drm->mode_config.max_width = 8198;
 	drm->mode_config.max_height = 8198;
 	drm->mode_config.funcs = &drv_mode_config_funcs;
+	drm->mode_config.helper_private = &drv_mode_config_helpers;
 
 	ret = component_bind_all(drm->dev, drm);
 	if (ret) {
@@ -102,7 +125,7 @@ static int mstar_drv_bind(struct device *dev)
 	if (ret)
 		goto finish_poll;
 
-	drm_fbdev_generic_setup(drm, 16);
+	mstar_fbdev_setup(drm, 16);
 
 	return 0;
 
@@ -120,7 +143,8 @@ static int mstar_drv_bind(struct device *dev)
 
 static void mstar_drv_unbind(struct device *dev)
 {
-	struct drm_device *drm = dev_get_drvdata(dev);
+	struct mstar_drv *drv = dev_get_drvdata(dev);
+	struct drm_device *drm = drv->drm;
 
 	drm_dev_unregister(drm);
 	drm_kms_helper_poll_fini(drm);
@@ -145,9 +169,34 @@ static int compare_of(struct device *dev, void *data)
 	return dev->of_node == np;
 }
 
+static void mstar_drm_put_ge(void *data)
+{
+	mstar_ge_put(data);
+}
+
 static int mstar_drm_probe(struct platform_device *pdev)
 {
-	return drm_of_component_probe(&pdev->dev, compare_of, &mstar_drv_master_ops);
+	struct device *dev = &pdev->dev;
+	struct mstar_drv *drv;
+	int ret;
+
+	drv = devm_kzalloc(dev, sizeof(*drv), GFP_KERNEL);
+	if (!drv)
+		return -ENOMEM;
+
+	/* The GE is optional, without it fbdev just draws with the CPU */
+	drv->ge = mstar_ge_get(dev);
+	if (IS_ERR(drv->ge))
+		return dev_err_probe(dev, PTR_ERR(drv->ge), "GE isn't ready\n");
+	if (drv->ge) {
+		ret = devm_add_action_or_reset(dev, mstar_drm_put_ge, drv->ge);
+		if (ret)
+			return ret;
+	}
+
+	platform_set_drvdata(pdev, drv);
+
+	return drm_of_component_probe(dev, compare_of, &mstar_drv_master_ops);
 }
 
 static int mstar_drm_remove(struct platform_device *pdev)
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * fbdev emulation for the GEM DMA buffers that the GOP scans out
+ * directly. This is the same as drm_fbdev_dma but fillrect and
+ * copyarea get pushed to the GE when it is available so fbcon
+ * scrolling doesn't eat the CPU. The CPU versions are still used if
+ * the GE is missing or refuses the operation.
+ *
+ * The draw ops can be called from printk so the GE jobs are only
+ * queued, anything that draws with the CPU or reads the buffer back
+ * has to wait for them with mstar_fbdev_sync() first.
+ */
+
+#include <linux/fb.h>
+#include <linux/seq_file.h>
+
+#include <drm/drm_debugfs.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fb_helper.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_framebuffer.h>
+#include <drm/drm_gem_dma_helper.h>
+#include <drm/drm_prime.h>
+
+#include "mstar_drm.h"
+#include "mstar_fbdev.h"
+#include "mstar_ge.h"
+
+/* Can this draw operation go to the GE? */
+static bool mstar_fbdev_can_offload(struct fb_info *info)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct mstar_drv *drv = fb_helper->dev->dev_private;
+
+	if (!drv->ge)
+		return false;
+
+	/* Keep it simple when things are already going wrong */
+	if (oops_in_progress)
+		return false;
+
+	switch (fb_helper->fb->format->format) {
+	case DRM_FORMAT_RGB565:
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Wait for the GE to finish with the buffer before the CPU touches it */
+static void mstar_fbdev_sync(struct fb_info *info)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct mstar_drv *drv = fb_helper->dev->dev_private;
+
+	if (drv->ge)
+		mstar_ge_sync(drv->ge);
+}
+
+static int mstar_fbdev_fb_sync(struct fb_info *info)
+{
+	mstar_fbdev_sync(info);
+
+	return 0;
+}
+
+static dma_addr_t mstar_fbdev_buf(struct fb_info *info, struct mstar_ge_buf_cfg *cfg)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct drm_framebuffer *fb = fb_helper->fb;
+
+	cfg->fourcc = fb->format->format;
+	cfg->width = fb->width;
+	cfg->height = fb->height;
+	cfg->pitch = fb->pitches[0];
+
+	return to_drm_gem_dma_obj(fb_helper->buffer->gem)->dma_addr;
+}
+
+static u8 mstar_fbdev_component(u32 pixel, const struct fb_bitfield *bf)
+{
+	u32 max, val;
+
+	/* No alpha channel means opaque */
+	if (!bf->length)
+		return 0xff;
+
+	max = (1 << bf->length) - 1;
+	val = (pixel >> bf->offset) & max;
+
+	return (val * 0xff) / max;
+}
+
+static void mstar_fbdev_color(struct fb_info *info, u32 color,
+			      struct mstar_ge_color *ge_color)
+{
+	u32 pixel = color;
+
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR ||
+	    info->fix.visual == FB_VISUAL_DIRECTCOLOR)
+		pixel = ((u32 *) info->pseudo_palette)[color];
+
+	ge_color->r = mstar_fbdev_component(pixel, &info->var.red);
+	ge_color->g = mstar_fbdev_component(pixel, &info->var.green);
+	ge_color->b = mstar_fbdev_component(pixel, &info->var.blue);
+	ge_color->a = mstar_fbdev_component(pixel, &info->var.transp);
+}
+
+static void mstar_fbdev_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct mstar_drv *drv = fb_helper->dev->dev_private;
+	u64 pixels = (u64) rect->width * rect->height;
+	struct mstar_ge_buf_cfg cfg;
+	struct mstar_ge_color color;
+	dma_addr_t addr;
+
+	if (rect->rop == ROP_COPY && mstar_fbdev_can_offload(info)) {
+		addr = mstar_fbdev_buf(info, &cfg);
+		mstar_fbdev_color(info, rect->color, &color);
+
+		if (!mstar_ge_fill(drv->ge, &cfg, addr,
+				   rect->dx, rect->dy, rect->width, rect->height,
+				   &color)) {
+			atomic64_add(pixels, &drv->fbdev_ge_pixels);
+			return;
+		}
+	}
+
+	mstar_fbdev_sync(info);
+	sys_fillrect(info, rect);
+	atomic64_add(pixels, &drv->fbdev_cpu_pixels);
+}
+
+static void mstar_fbdev_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct mstar_drv *drv = fb_helper->dev->dev_private;
+	u64 pixels = (u64) area->width * area->height;
+	struct mstar_ge_buf_cfg cfg;
+	dma_addr_t addr;
+
+	if (mstar_fbdev_can_offload(info)) {
+		addr = mstar_fbdev_buf(info, &cfg);
+
+		if (!mstar_ge_copy(drv->ge, &cfg, addr,
+				   area->sx, area->sy, area->dx, area->dy,
+				   area->width, area->height)) {
+			atomic64_add(pixels, &drv->fbdev_ge_pixels);
+			return;
+		}
+	}
+
+	mstar_fbdev_sync(info);
+	sys_copyarea(info, area);
+	atomic64_add(pixels, &drv->fbdev_cpu_pixels);
+}
+
+static void mstar_fbdev_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+	struct mstar_drv *drv = fb_helper->dev->dev_private;
+
+	mstar_fbdev_sync(info);
+	sys_imageblit(info, image);
+	atomic64_add((u64) image->width * image->height, &drv->fbdev_cpu_pixels);
+}
+
+static int mstar_fbdev_fb_open(struct fb_info *info, int user)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+
+	/* No need to take a ref for fbcon because it unbinds on unregister */
+	if (user && !try_module_get(fb_helper->dev->driver->fops->owner))
+		return -ENODEV;
+
+	return 0;
+}
+
+static int mstar_fbdev_fb_release(struct fb_info *info, int user)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+
+	if (user)
+		module_put(fb_helper->dev->driver->fops->owner);
+
+	return 0;
+}
+
+static void mstar_fbdev_fb_destroy(struct fb_info *info)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+
+	if (!fb_helper->dev)
+		return;
+
+	drm_fb_helper_fini(fb_helper);
+
+	drm_client_buffer_vunmap(fb_helper->buffer);
+	drm_client_framebuffer_delete(fb_helper->buffer);
+	drm_client_release(&fb_helper->client);
+	drm_fb_helper_unprepare(fb_helper);
+	kfree(fb_helper);
+}
+
+static int mstar_fbdev_fb_mmap(struct fb_info *info, struct vm_area_struct *vma)
+{
+	struct drm_fb_helper *fb_helper = info->par;
+
+	return drm_gem_prime_mmap(fb_helper->buffer->gem, vma);
+}
+
+static const struct fb_ops mstar_fbdev_fb_ops = {
+	.owner = THIS_MODULE,
+	.fb_open = mstar_fbdev_fb_open,
+	.fb_release = mstar_fbdev_fb_release,
+	__FB_DEFAULT_DMAMEM_OPS_RDWR,
+	DRM_FB_HELPER_DEFAULT_OPS,
+	.fb_fillrect = mstar_fbdev_fillrect,
+	.fb_copyarea = mstar_fbdev_copyarea,
+	.fb_imageblit = mstar_fbdev_imageblit,
+	.fb_sync = mstar_fbdev_fb_sync,
+	.fb_mmap = mstar_fbdev_fb_mmap,
+	.fb_destroy = mstar_fbdev_fb_destroy,
+};
+
+static int mstar_fbdev_fb_probe(struct drm_fb_helper *fb_helper,
+				struct drm_fb_helper_surface_size *sizes)
+{
+	struct drm_client_dev *client = &fb_helper->client;
+	struct drm_device *dev = fb_helper->dev;
+	struct drm_client_buffer *buffer;
+	struct drm_framebuffer *fb;
+	struct fb_info *info;
+	struct iosys_map map;
+	u32 format;
+	int ret;
+
+	format = drm_mode_legacy_fb_format(sizes->surface_bpp, sizes->surface_depth);
+	buffer = drm_client_framebuffer_create(client, sizes->surface_width,
+					       sizes->surface_height, format);
+	if (IS_ERR(buffer))
+		return PTR_ERR(buffer);
+
+	fb = buffer->fb;
+
+	ret = drm_client_buffer_vmap(buffer, &map);
+	if (ret)
+		goto err_drm_client_buffer_delete;
+
+	fb_helper->buffer = buffer;
+	fb_helper->fb = fb;
+
+	info = drm_fb_helper_alloc_info(fb_helper);
+	if (IS_ERR(info)) {
+		ret = PTR_ERR(info);
+		goto err_drm_client_buffer_vunmap;
+	}
+
+	drm_fb_helper_fill_info(info, fb_helper, sizes);
+
+	info->fbops = &mstar_fbdev_fb_ops;
+
+	/* screen */
+	info->flags |= FBINFO_VIRTFB;
+	info->screen_size = sizes->surface_height * fb->pitches[0];
+	info->screen_buffer = map.vaddr;
+	info->fix.smem_start = page_to_phys(virt_to_page(info->screen_buffer));
+	info->fix.smem_len = info->screen_size;
+
+	return 0;
+
+err_drm_client_buffer_vunmap:
+	fb_helper->fb = NULL;
+	fb_helper->buffer = NULL;
+	drm_client_buffer_vunmap(buffer);
+err_drm_client_buffer_delete:
+	drm_client_framebuffer_delete(buffer);
+	dev_err(dev->dev, "failed to create fbdev buffer: %d\n", ret);
+	return ret;
+}
+
+static const struct drm_fb_helper_funcs mstar_fbdev_helper_funcs = {
+	.fb_probe = mstar_fbdev_fb_probe,
+};
+
+static void mstar_fbdev_client_unregister(struct drm_client_dev *client)
+{
+	struct drm_fb_helper *fb_helper = drm_fb_helper_from_client(client);
+
+	if (fb_helper->info) {
+		drm_fb_helper_unregister_info(fb_helper);
+	} else {
+		drm_client_release(&fb_helper->client);
+		drm_fb_helper_unprepare(fb_helper);
+		kfree(fb_helper);
+	}
+}
+
+static int mstar_fbdev_client_restore(struct drm_client_dev *client)
+{
+	drm_fb_helper_lastclose(client->dev);
+
+	return 0;
+}
+
+static int mstar_fbdev_client_hotplug(struct drm_client_dev *client)
+{
+	struct drm_fb_helper *fb_helper = drm_fb_helper_from_client(client);
+	struct drm_device *dev = client->dev;
+	int ret;
+
+	if (dev->fb_helper)
+		return drm_fb_helper_hotplug_event(dev->fb_helper);
+
+	ret = drm_fb_helper_init(dev, fb_helper);
+	if (ret)
+		goto err;
+
+	ret = drm_fb_helper_initial_config(fb_helper);
+	if (ret)
+		goto err_fb_helper_fini;
+
+	return 0;
+
+err_fb_helper_fini:
+	drm_fb_helper_fini(fb_helper);
+err:
+	dev_err(dev->dev, "Failed to setup fbdev emulation: %d\n", ret);
+	return ret;
+}
+
+static const struct drm_client_funcs mstar_fbdev_client_funcs = {
+	.owner		= THIS_MODULE,
+	.unregister	= mstar_fbdev_client_unregister,
+	.restore	= mstar_fbdev_client_restore,
+	.hotplug	= mstar_fbdev_client_hotplug,
+};
+
+static int mstar_fbdev_offload_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct mstar_drv *drv = entry->dev->dev_private;
+
+	seq_printf(m, "ge: %s\n", drv->ge ? "yes" : "no");
+	seq_printf(m, "ge pixels: %lld\n", atomic64_read(&drv->fbdev_ge_pixels));
+	seq_printf(m, "cpu pixels: %lld\n", atomic64_read(&drv->fbdev_cpu_pixels));
+
+	return 0;
+}
+
+void mstar_fbdev_setup(struct drm_device *drm, unsigned int preferred_bpp)
+{
+	struct drm_fb_helper *fb_helper;
+	int ret;
+
+	drm_debugfs_add_file(drm, "fbdev_offload", mstar_fbdev_offload_show, NULL);
+
+	fb_helper = kzalloc(sizeof(*fb_helper), GFP_KERNEL);
+	if (!fb_helper)
+		return;
+	drm_fb_helper_prepare(drm, fb_helper, preferred_bpp, &mstar_fbdev_helper_funcs);
+
+	ret = drm_client_init(drm, &fb_helper->client, "fbdev", &mstar_fbdev_client_funcs);
+	if (ret) {
+		dev_err(drm->dev, "Failed to register fbdev client: %d\n", ret);
+		goto err_client_init;
+	}
+
+	drm_client_register(&fb_helper->client);
+
+	return;
+
+err_client_init:
+	drm_fb_helper_unprepare(fb_helper);
+	kfree(fb_helper);
+}
@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef _MSTAR_FBDEV_H_
+#define _MSTAR_FBDEV_H_
+
+struct drm_device;
+
+#ifdef CONFIG_DRM_FBDEV_EMULATION
+void mstar_fbdev_setup(struct drm_device *drm, unsigned int preferred_bpp);
+#else
+static inline void mstar_fbdev_setup(struct drm_device *drm, unsigned int preferred_bpp)
+{ }
+#endif
+
+#endif /* _MSTAR_FBDEV_H_ */
@@ -3,22 +3,36 @@
 #include <linux/clk.h>
 #include <linux/devfreq.h>
 #include <linux/dma-buf.h>
+#include <linux/dma-fence.h>
 #include <linux/dma-mapping.h>
+#include <linux/file.h>
 #include <linux/interrupt.h>
+#include <linux/iopoll.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/miscdevice.h>
 #include <linux/of_device.h>
 #include <linux/of_graph.h>
 #include <linux/of_irq.h>
+#include <linux/of_platform.h>
 #include <linux/platform_device.h>
+#include <linux/pm_opp.h>
 #include <linux/pm_runtime.h>
 #include <linux/regmap.h>
 #include <linux/slab.h>
+#include <linux/sync_file.h>
+#include <linux/workqueue.h>
 
 #include <uapi/drm/mstar_ge.h>
+#include <uapi/drm/mstar_ge_async.h>
+
+#include "mstar_ge.h"
 
 #define DRIVER_NAME "mstar-ge"
 
+/* How many of the most recent job execution times to keep */
+#define MSTAR_GE_JOB_TRACE_LEN	64
+
 #define REG_CTRL		0x0
 #define REG_CTRL1		0x4
 #define REG_CMQ_STATUS		0x1c
@@ -208,8 +222,25 @@ struct mstar_ge {
 	spinlock_t lock;
 	struct list_head queue;
 	int inflight;
+	/* in-kernel jobs queued, protected by lock */
+	int kernel_inflight;
 	wait_queue_head_t dma_wait;
 
+	/* load tracking for devfreq, protected by lock */
+	ktime_t busy_since;
+	ktime_t stats_since;
+	u64 busy_us;
+
+	/* execution time of the last few jobs in us, protected by lock */
+	u32 job_trace[MSTAR_GE_JOB_TRACE_LEN];
+	unsigned int job_trace_head;
+	u64 jobs_done;
+
+	/* batch completion fences, fence_seqno is protected by lock */
+	spinlock_t fence_lock;
+	u64 fence_context;
+	u64 fence_seqno;
+
 	struct miscdevice ge_dev;
 
 	struct kmem_cache *jobs;
@@ -255,10 +286,15 @@ struct mstar_ge_dma_buf {
 	struct dma_buf_attachment *dma_attachment;
 };
 
+struct mstar_ge_batch;
+
 /* Everything needed to do a single operation */
 struct mstar_ge_job {
 	unsigned long tag;
 
+	/* batch this job belongs to, NULL for the self tests */
+	struct mstar_ge_batch *batch;
+
 	struct mstar_ge_opdata opdata;
 
 	/* src and dst buffer handling */
@@ -270,7 +306,37 @@ struct mstar_ge_job {
 
 	struct list_head queue;
 
+	/* when the job was handed to the hardware */
+	ktime_t started;
+
+	/* queued by an in-kernel user, freed when it completes */
+	bool kernel;
+
 	bool dma_done;
+	int error;
+};
+
+/*
+ * All of the jobs from a single queue request. The buffers stay mapped
+ * until the last job has finished, at which point the fence is signalled
+ * and the rest is torn down from a work item.
+ */
+struct mstar_ge_batch {
+	struct dma_fence fence;
+	struct mstar_ge *ge;
+
+	struct mstar_ge_job *jobs[MSTAR_GE_MAX_JOBS];
+	unsigned int num_jobs;
+	/* jobs not completed yet, protected by ge->lock */
+	unsigned int pending;
+
+	unsigned int num_bufs;
+	enum dma_data_direction dma_dirs[2];
+	struct dma_buf *dma_bufs[2];
+	struct dma_buf_attachment *dma_attachs[2];
+	struct sg_table *dma_mappings[2];
+
+	struct work_struct cleanup;
 };
 
 static inline void mstar_ge_job_init(void *job)
@@ -315,27 +381,30 @@ static void mstar_ge_tag(struct mstar_ge *ge)
 	dev_dbg(ge->dev, "tag is: %d\n", (unsigned) ge->tag);
 }
 
-static void mstar_ge_set_src(struct mstar_ge *ge, dma_addr_t dmaaddr, unsigned int pitch)
+static void mstar_ge_set_src(struct mstar_ge *ge, struct regmap_field_batch *batch,
+			     dma_addr_t dmaaddr, unsigned int pitch)
 {
-	regmap_field_write(ge->srcl, dmaaddr);
-	regmap_field_write(ge->srch, dmaaddr >> 16);
-	regmap_field_write(ge->srcpitch, pitch);
+	regmap_field_batch_write(batch, ge->srcl, dmaaddr);
+	regmap_field_batch_write(batch, ge->srch, dmaaddr >> 16);
+	regmap_field_batch_write(batch, ge->srcpitch, pitch);
 }
 
-static void mstar_ge_set_dst(struct mstar_ge *ge, dma_addr_t dmaaddr, unsigned int pitch)
+static void mstar_ge_set_dst(struct mstar_ge *ge, struct regmap_field_batch *batch,
+			     dma_addr_t dmaaddr, unsigned int pitch)
 {
-	regmap_field_write(ge->dstl, dmaaddr);
-	regmap_field_write(ge->dsth, dmaaddr >> 16);
-	regmap_field_write(ge->dstpitch, pitch);
+	regmap_field_batch_write(batch, ge->dstl, dmaaddr);
+	regmap_field_batch_write(batch, ge->dsth, dmaaddr >> 16);
+	regmap_field_batch_write(batch, ge->dstpitch, pitch);
 }
 
-static void mstar_ge_set_clip(struct mstar_ge *ge, unsigned int left, unsigned int top,
-		unsigned int right, unsigned int bottom)
+static void mstar_ge_set_clip(struct mstar_ge *ge, struct regmap_field_batch *batch,
+			      unsigned int left, unsigned int top,
+			      unsigned int right, unsigned int bottom)
 {
-	regmap_field_write(ge->clip_left, left);
-	regmap_field_write(ge->clip_top, top);
-	regmap_field_write(ge->clip_right, right);
-	regmap_field_write(ge->clip_bottom, bottom);
+	regmap_field_batch_write(batch, ge->clip_left, left);
+	regmap_field_batch_write(batch, ge->clip_top, top);
+	regmap_field_batch_write(batch, ge->clip_right, right);
+	regmap_field_batch_write(batch, ge->clip_bottom, bottom);
 }
 
 static void mstar_ge_set_priv0(struct mstar_ge *ge, unsigned int x, unsigned int y)
@@ -356,13 +425,13 @@ static void mstar_ge_set_priv2(struct mstar_ge *ge, unsigned int x, unsigned int
 	regmap_field_write(ge->y2, y);
 }
 
-static void mstar_ge_set_start_color(struct mstar_ge *ge,
-				      struct mstar_ge_color *start_color)
+static void mstar_ge_set_start_color(struct mstar_ge *ge, struct regmap_field_batch *batch,
+				     struct mstar_ge_color *start_color)
 {
-	regmap_field_write(ge->b_st, start_color->b);
-	regmap_field_write(ge->g_st, start_color->g);
-	regmap_field_write(ge->r_st, start_color->r);
-	regmap_field_write(ge->a_st, start_color->a);
+	regmap_field_batch_write(batch, ge->b_st, start_color->b);
+	regmap_field_batch_write(batch, ge->g_st, start_color->g);
+	regmap_field_batch_write(batch, ge->r_st, start_color->r);
+	regmap_field_batch_write(batch, ge->a_st, start_color->a);
 }
 
 static int mstar_ge_do_line(struct mstar_ge *ge,
@@ -625,6 +694,7 @@ static void mstar_ge_read_p256(struct mstar_ge *ge)
 static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 {
 	int dst_fmt = mstar_ge_drm_color_to_gop(job->dst_cfg.fourcc);
+	struct regmap_field_batch batch;
 	struct device *dev = ge->dev;
 	int src_fmt;
 	int ret;
@@ -636,6 +706,13 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 		goto abort_pm_get;
 	}
 
+	/*
+	 * The buffer, clip and colour setup is lots of small fields packed
+	 * into the same registers so collect it up and write each register
+	 * once before anything that kicks the engine.
+	 */
+	regmap_field_batch_init(&batch, ge->regmap);
+
 	/* src is optional for some ops*/
 	if (job->src_addr) {
 		src_fmt = mstar_ge_drm_color_to_gop(job->src_cfg.fourcc);
@@ -646,8 +723,8 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 
 		dev_dbg(ge->dev, "Setting source %d x %d (%d)\n",
 				job->src_cfg.width, job->src_cfg.height, job->src_cfg.pitch);
-		mstar_ge_set_src(ge, job->src_addr, job->src_cfg.pitch);
-		regmap_field_write(ge->srcclrfmt, src_fmt);
+		mstar_ge_set_src(ge, &batch, job->src_addr, job->src_cfg.pitch);
+		regmap_field_batch_write(&batch, ge->srcclrfmt, src_fmt);
 	} else {
 		switch (job->opdata.op) {
 		case MSTAR_GE_OP_BITBLT:
@@ -668,8 +745,12 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 
 	dev_dbg(ge->dev, "Setting destination %d x %d (%d)\n",
 			job->dst_cfg.width, job->dst_cfg.height, job->dst_cfg.pitch);
-	mstar_ge_set_dst(ge, job->dst_addr, job->dst_cfg.pitch);
-	regmap_field_write(ge->dstclrfmt, dst_fmt);
+	mstar_ge_set_dst(ge, &batch, job->dst_addr, job->dst_cfg.pitch);
+	regmap_field_batch_write(&batch, ge->dstclrfmt, dst_fmt);
+
+	ret = regmap_field_batch_flush(&batch, NULL);
+	if (ret)
+		goto abort;
 
 	/* */
 	mstar_ge_tag(ge);
@@ -686,16 +767,30 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 	regmap_field_write(ge->pri_y_dir, 0);
 	regcache_cache_only(ge->regmap, false);
 
-	regmap_field_write(ge->rot, 0);
+	regmap_field_batch_write(&batch, ge->rot, 0);
 
 	/* set the clip */
-	mstar_ge_set_clip(ge, 0, 0,
+	mstar_ge_set_clip(ge, &batch, 0, 0,
 			job->dst_cfg.width - 1,
 			job->dst_cfg.height - 1);
 
 	switch (job->opdata.op) {
 	case MSTAR_GE_OP_LINE:
-		mstar_ge_set_start_color(ge, &job->opdata.line.start_color);
+		mstar_ge_set_start_color(ge, &batch, &job->opdata.line.start_color);
+		break;
+	case MSTAR_GE_OP_RECTFILL:
+		mstar_ge_set_start_color(ge, &batch, &job->opdata.rectfill.start_color);
+		break;
+	default:
+		break;
+	}
+
+	ret = regmap_field_batch_flush(&batch, NULL);
+	if (ret)
+		goto abort;
+
+	switch (job->opdata.op) {
+	case MSTAR_GE_OP_LINE:
 		mstar_ge_do_line(ge,
 				 job->opdata.line.x0,
 				 job->opdata.line.y0,
@@ -703,7 +798,6 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 				 job->opdata.line.y1);
 		break;
 	case MSTAR_GE_OP_RECTFILL:
-		mstar_ge_set_start_color(ge, &job->opdata.rectfill.start_color);
 		mstar_ge_do_rectfill(ge,
 				     job->opdata.rectfill.x0,
 				     job->opdata.rectfill.y0,
@@ -730,13 +824,14 @@ static int mstar_ge_run_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 		goto abort;
 	}
 
+	job->started = ktime_get();
+
 	return 0;
 
 abort:
 	dev_err(dev, "failed to run job: %d\n", ret);
 	pm_runtime_put(dev);
 abort_pm_get:
-	ge->inflight--;
 	return ret;
 }
 
@@ -747,10 +842,58 @@ static void mstar_ge_wait_for_idle(const struct mstar_ge *ge)
 	}
 }
 
+/* Must be called with ge->lock held */
+static void mstar_ge_job_done(struct mstar_ge *ge, struct mstar_ge_job *job, int err)
+{
+	struct mstar_ge_batch *batch = job->batch;
+
+	job->dma_done = true;
+	job->error = err;
+	list_del(&job->queue);
+	ge->inflight--;
+
+	/* engine went idle, close the busy period */
+	if (!ge->inflight)
+		ge->busy_us += ktime_us_delta(ktime_get(), ge->busy_since);
+
+	if (job->kernel) {
+		ge->kernel_inflight--;
+		kmem_cache_free(ge->jobs, job);
+		return;
+	}
+
+	if (!batch)
+		return;
+
+	if (err && !batch->fence.error)
+		dma_fence_set_error(&batch->fence, err);
+
+	if (--batch->pending == 0) {
+		dma_fence_signal(&batch->fence);
+		schedule_work(&batch->cleanup);
+	}
+}
+
+/* Must be called with ge->lock held */
+static void mstar_ge_run_next(struct mstar_ge *ge)
+{
+	struct mstar_ge_job *job;
+	int ret;
+
+	while (ge->inflight) {
+		job = list_first_entry(&ge->queue, struct mstar_ge_job, queue);
+		ret = mstar_ge_run_job(ge, job);
+		if (!ret)
+			break;
+
+		/* job never made it to the hardware, fail it and move on */
+		mstar_ge_job_done(ge, job, ret);
+	}
+}
+
 static int mstar_ge_queue_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 {
 	unsigned long flags;
-	int ret = 0;
 
 	/* dst is mandatory */
 	if (!job->dst_addr)
@@ -758,17 +901,58 @@ static int mstar_ge_queue_job(struct mstar_ge *ge, struct mstar_ge_job *job)
 
 	spin_lock_irqsave(&ge->lock, flags);
 	ge->inflight++;
+	if (job->kernel)
+		ge->kernel_inflight++;
 	list_add_tail(&job->queue, &ge->queue);
 
 	/* Start the first job */
-	if (ge->inflight == 1)
-		ret = mstar_ge_run_job(ge, job);
+	if (ge->inflight == 1) {
+		ge->busy_since = ktime_get();
+		mstar_ge_run_next(ge);
+	}
 
 	spin_unlock_irqrestore(&ge->lock, flags);
 
+	return 0;
+}
+
+static const struct dma_fence_ops mstar_ge_fence_ops;
+
+/*
+ * Queue all of the jobs in a batch in one go so that the batch
+ * runs back to back from the interrupt handler without any
+ * further involvement from the caller.
+ *
+ * The fence gets its seqno here rather than at allocation so seqnos
+ * are handed out in the order batches hit the queue, and so signal,
+ * no matter how long each submitter took to map its buffers. Nothing
+ * outside of the submitter can see the fence before this. The initial
+ * reference belongs to the queue, the caller gets a second one.
+ */
+static void mstar_ge_queue_batch(struct mstar_ge *ge, struct mstar_ge_batch *batch)
+{
+	unsigned long flags;
+	bool idle;
+	int i;
 
+	batch->pending = batch->num_jobs;
 
-	return ret;
+	spin_lock_irqsave(&ge->lock, flags);
+	batch->fence.seqno = ++ge->fence_seqno;
+	dma_fence_get(&batch->fence);
+
+	idle = !ge->inflight;
+
+	for (i = 0; i < batch->num_jobs; i++)
+		list_add_tail(&batch->jobs[i]->queue, &ge->queue);
+	ge->inflight += batch->num_jobs;
+
+	if (idle) {
+		ge->busy_since = ktime_get();
+		mstar_ge_run_next(ge);
+	}
+
+	spin_unlock_irqrestore(&ge->lock, flags);
 }
 
 static irqreturn_t mstar_ge_irq(int irq, void *data)
@@ -780,7 +964,18 @@ static irqreturn_t mstar_ge_irq(int irq, void *data)
 	unsigned long flags;
 	int ret = IRQ_HANDLED;
 
+	/*
+	 * Status is read and acked under the lock as mstar_ge_sync() can
+	 * call this too, only one of them gets to retire the job.
+	 */
+	spin_lock_irqsave(&ge->lock, flags);
+
 	regmap_field_read(ge->irq_status, &status);
+	if (!status) {
+		ret = IRQ_NONE;
+		goto out;
+	}
+
 	regmap_field_write(ge->irq_force, 0);
 
 	/*
@@ -794,25 +989,21 @@ static irqreturn_t mstar_ge_irq(int irq, void *data)
 
 	dev_dbg(dev, "interrupt, %x\n", status);
 
-	spin_lock_irqsave(&ge->lock, flags);
-
 	if (!ge->inflight) {
 		dev_err(dev, "Interrupt when no jobs queued!\n");
 		ret = IRQ_NONE;
 		goto out;
 	}
 
-	/* free the finished job */
+	/* retire the finished job */
 	job = list_first_entry(&ge->queue, struct mstar_ge_job, queue);
-	job->dma_done = true;
-	list_del(&job->queue);
-	ge->inflight--;
+	ge->job_trace[ge->job_trace_head] = ktime_us_delta(ktime_get(), job->started);
+	ge->job_trace_head = (ge->job_trace_head + 1) % MSTAR_GE_JOB_TRACE_LEN;
+	ge->jobs_done++;
+	mstar_ge_job_done(ge, job, 0);
 
 	/* run next job */
-	if (ge->inflight) {
-		job = list_first_entry(&ge->queue, struct mstar_ge_job, queue);
-		mstar_ge_run_job(ge, job);
-	}
+	mstar_ge_run_next(ge);
 
 	/* decrement the pm runtime counter */
 	pm_runtime_put(dev);
@@ -1062,19 +1253,215 @@ static void mstar_ge_test_posttest(
 	mstar_ge_asciiart(dst->buf, dst->cfg.width, dst->cfg.height);
 }
 
-static struct mstar_ge_job* mstar_ge_alloc_job(struct mstar_ge *ge)
+static struct mstar_ge_job* mstar_ge_alloc_job(struct mstar_ge *ge, gfp_t gfp)
 {
 	struct mstar_ge_job *j;
 
-	j = kmem_cache_alloc(ge->jobs, GFP_KERNEL);
+	j = kmem_cache_alloc(ge->jobs, gfp);
 	if (!j)
 		return NULL;
 
+	j->kernel = false;
 	j->dma_done = false;
+	j->error = 0;
+	j->batch = NULL;
 
 	return j;
 }
 
+/*
+ * In-kernel users, i.e. the fbdev emulation. The fbcon draw ops can be
+ * called from printk with spinlocks held or interrupts off, so these
+ * only queue a single job against one buffer and never sleep. The job
+ * is freed when it completes and mstar_ge_sync() busy waits for all of
+ * them before the CPU touches the buffer.
+ *
+ * mstar_ge_get() returns NULL if dev doesn't have a GE, and
+ * -EPROBE_DEFER if it has one that hasn't probed yet, so call it from
+ * probe. A device link makes sure dev is unbound before the GE goes
+ * away.
+ */
+struct mstar_ge *mstar_ge_get(struct device *dev)
+{
+	struct platform_device *pdev;
+	struct device_node *np;
+	struct mstar_ge *ge;
+
+	np = of_parse_phandle(dev->of_node, "sstar,ge", 0);
+	if (!np)
+		return NULL;
+
+	pdev = of_find_device_by_node(np);
+	of_node_put(np);
+	if (!pdev)
+		return NULL;
+
+	ge = platform_get_drvdata(pdev);
+	if (!ge || !device_is_bound(&pdev->dev)) {
+		put_device(&pdev->dev);
+		return ERR_PTR(-EPROBE_DEFER);
+	}
+
+	if (!device_link_add(dev, &pdev->dev, DL_FLAG_AUTOREMOVE_CONSUMER)) {
+		dev_warn(dev, "failed to link to the GE\n");
+		put_device(&pdev->dev);
+		return NULL;
+	}
+
+	return ge;
+}
+EXPORT_SYMBOL_GPL(mstar_ge_get);
+
+void mstar_ge_put(struct mstar_ge *ge)
+{
+	put_device(ge->dev);
+}
+EXPORT_SYMBOL_GPL(mstar_ge_put);
+
+static int mstar_ge_queue_kernel_job(struct mstar_ge *ge, struct mstar_ge_job *job)
+{
+	int ret;
+
+	job->kernel = true;
+
+	ret = mstar_ge_queue_job(ge, job);
+	if (ret)
+		kmem_cache_free(ge->jobs, job);
+
+	return ret;
+}
+
+#define MSTAR_GE_SYNC_POLL_US		10
+#define MSTAR_GE_SYNC_TIMEOUT_US	(100 * USEC_PER_MSEC)
+
+static bool mstar_ge_kernel_idle(struct mstar_ge *ge)
+{
+	unsigned int status;
+
+	/*
+	 * With interrupts off the completion interrupt might never get
+	 * to us, so look for it ourselves.
+	 */
+	if (irqs_disabled() && READ_ONCE(ge->kernel_inflight)) {
+		regmap_field_read(ge->irq_status, &status);
+		if (status)
+			mstar_ge_irq(0, ge);
+	}
+
+	return !READ_ONCE(ge->kernel_inflight);
+}
+
+/* Wait for all of the in-kernel jobs to finish, from any context */
+int mstar_ge_sync(struct mstar_ge *ge)
+{
+	struct mstar_ge_job *job, *tmp;
+	bool running = false;
+	unsigned long flags;
+	bool idle;
+	int ret;
+
+	ret = read_poll_timeout_atomic(mstar_ge_kernel_idle, idle, idle,
+				       MSTAR_GE_SYNC_POLL_US,
+				       MSTAR_GE_SYNC_TIMEOUT_US, false, ge);
+	if (!ret)
+		return 0;
+
+	dev_err(ge->dev, "timeout waiting for in-kernel jobs to finish\n");
+
+	/* Give up on them so a late completion can't touch a freed job */
+	spin_lock_irqsave(&ge->lock, flags);
+	list_for_each_entry_safe(job, tmp, &ge->queue, queue) {
+		if (!job->kernel)
+			continue;
+
+		/* the job at the head is on the hardware and holds a pm ref */
+		if (job == list_first_entry(&ge->queue, struct mstar_ge_job, queue))
+			running = true;
+		mstar_ge_job_done(ge, job, -ETIMEDOUT);
+	}
+	if (running) {
+		pm_runtime_put(ge->dev);
+		mstar_ge_run_next(ge);
+	}
+	spin_unlock_irqrestore(&ge->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mstar_ge_sync);
+
+int mstar_ge_fill(struct mstar_ge *ge, const struct mstar_ge_buf_cfg *cfg, dma_addr_t addr,
+		  unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+		  const struct mstar_ge_color *color)
+{
+	struct mstar_ge_job *job;
+
+	if (!w || !h || x + w > cfg->width || y + h > cfg->height)
+		return -EINVAL;
+
+	job = mstar_ge_alloc_job(ge, GFP_ATOMIC);
+	if (!job)
+		return -ENOMEM;
+
+	memset(&job->opdata, 0, sizeof(job->opdata));
+	job->opdata.op = MSTAR_GE_OP_RECTFILL;
+	job->opdata.rectfill.x0 = x;
+	job->opdata.rectfill.y0 = y;
+	job->opdata.rectfill.x1 = x + w - 1;
+	job->opdata.rectfill.y1 = y + h - 1;
+	job->opdata.rectfill.start_color = *color;
+
+	job->src_addr = (dma_addr_t) NULL;
+	job->dst_addr = addr;
+	memcpy(&job->dst_cfg, cfg, sizeof(job->dst_cfg));
+
+	return mstar_ge_queue_kernel_job(ge, job);
+}
+
+/*
+ * Copy an area within a single buffer. The engine walks the destination
+ * top to bottom so overlapping copies only work if the destination is
+ * above the source, anything else is rejected and left for the caller
+ * to do another way.
+ */
+int mstar_ge_copy(struct mstar_ge *ge, const struct mstar_ge_buf_cfg *cfg, dma_addr_t addr,
+		  unsigned int sx, unsigned int sy, unsigned int dx, unsigned int dy,
+		  unsigned int w, unsigned int h)
+{
+	struct mstar_ge_job *job;
+	bool overlap;
+
+	if (!w || !h ||
+	    sx + w > cfg->width || sy + h > cfg->height ||
+	    dx + w > cfg->width || dy + h > cfg->height)
+		return -EINVAL;
+
+	overlap = sx < dx + w && dx < sx + w &&
+		  sy < dy + h && dy < sy + h;
+	if (overlap && dy >= sy)
+		return -EOPNOTSUPP;
+
+	job = mstar_ge_alloc_job(ge, GFP_ATOMIC);
+	if (!job)
+		return -ENOMEM;
+
+	memset(&job->opdata, 0, sizeof(job->opdata));
+	job->opdata.op = MSTAR_GE_OP_BITBLT;
+	job->opdata.bitblt.src_x0 = sx;
+	job->opdata.bitblt.src_y0 = sy;
+	job->opdata.bitblt.dst_x0 = dx;
+	job->opdata.bitblt.dst_y0 = dy;
+	job->opdata.bitblt.dst_x1 = dx + w - 1;
+	job->opdata.bitblt.dst_y1 = dy + h - 1;
+	job->opdata.bitblt.flags = MSTAR_GE_ROTATION_0;
+
+	job->src_addr = addr;
+	job->dst_addr = addr;
+	memcpy(&job->src_cfg, cfg, sizeof(job->src_cfg));
+	memcpy(&job->dst_cfg, cfg, sizeof(job->dst_cfg));
+
+	return mstar_ge_queue_kernel_job(ge, job);
+}
+
 static void mstar_ge_reset_job(struct mstar_ge_job *j)
 {
 	j->dma_done = false;
@@ -1087,7 +1474,7 @@ static int mstar_ge_test(struct mstar_ge *ge)
 	void *src_alloc, *dst_alloc;
 	int ret;
 
-	j = mstar_ge_alloc_job(ge);
+	j = mstar_ge_alloc_job(ge, GFP_KERNEL);
 	if (!j) {
 		dev_err(ge->dev, "Failed to allocate test job\n");
 		return -ENOMEM;
@@ -1324,23 +1711,186 @@ static int mstar_ge_validate_buffer(struct mstar_ge *ge, struct mstar_ge_buf *bu
 	return 0;
 }
 
-static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg)
+static const char *mstar_ge_fence_get_driver_name(struct dma_fence *fence)
+{
+	return DRIVER_NAME;
+}
+
+static const char *mstar_ge_fence_get_timeline_name(struct dma_fence *fence)
+{
+	return "ge";
+}
+
+static void mstar_ge_fence_release(struct dma_fence *fence)
+{
+	struct mstar_ge_batch *batch = container_of(fence, struct mstar_ge_batch, fence);
+
+	kfree_rcu(batch, fence.rcu);
+}
+
+static const struct dma_fence_ops mstar_ge_fence_ops = {
+	.get_driver_name = mstar_ge_fence_get_driver_name,
+	.get_timeline_name = mstar_ge_fence_get_timeline_name,
+	.release = mstar_ge_fence_release,
+};
+
+static void mstar_ge_batch_unmap(struct mstar_ge_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->num_bufs; i++) {
+		if (batch->dma_mappings[i])
+			dma_buf_unmap_attachment(batch->dma_attachs[i], batch->dma_mappings[i],
+						 batch->dma_dirs[i]);
+		if (batch->dma_attachs[i])
+			dma_buf_detach(batch->dma_bufs[i], batch->dma_attachs[i]);
+		dma_buf_put(batch->dma_bufs[i]);
+	}
+	batch->num_bufs = 0;
+}
+
+static void mstar_ge_batch_free_jobs(struct mstar_ge_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->num_jobs; i++)
+		kmem_cache_free(batch->ge->jobs, batch->jobs[i]);
+	batch->num_jobs = 0;
+}
+
+static void mstar_ge_batch_cleanup(struct work_struct *work)
+{
+	struct mstar_ge_batch *batch = container_of(work, struct mstar_ge_batch, cleanup);
+
+	mstar_ge_batch_free_jobs(batch);
+	mstar_ge_batch_unmap(batch);
+
+	/* drop the reference held by the queue */
+	dma_fence_put(&batch->fence);
+}
+
+static struct mstar_ge_batch *mstar_ge_alloc_batch(struct mstar_ge *ge)
+{
+	struct mstar_ge_batch *batch;
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return NULL;
+
+	batch->ge = ge;
+	INIT_WORK(&batch->cleanup, mstar_ge_batch_cleanup);
+
+	/* The seqno is assigned by mstar_ge_queue_batch() */
+	dma_fence_init(&batch->fence, &mstar_ge_fence_ops, &ge->fence_lock,
+		       ge->fence_context, 0);
+
+	return batch;
+}
+
+static int mstar_ge_batch_map(struct mstar_ge *ge, struct mstar_ge_batch *batch,
+			      struct mstar_ge_buf *bufs, int num_bufs, dma_addr_t *dma_addrs)
+{
+	int i;
+
+	/* Figure out the DMA directions */
+	if (num_bufs == 1)
+		batch->dma_dirs[0] = DMA_FROM_DEVICE;
+	else {
+		batch->dma_dirs[0] = DMA_TO_DEVICE;
+		batch->dma_dirs[1] = DMA_FROM_DEVICE;
+	}
+
+	for (i = 0; i < num_bufs; i++) {
+		struct mstar_ge_buf *buf = &bufs[i];
+		struct dma_buf *dma_buf;
+
+		dma_buf = dma_buf_get(buf->fd);
+		if (IS_ERR(dma_buf)) {
+			dev_err(ge->dev, "failed to get dma_buf for buffer\n");
+			return PTR_ERR(dma_buf);
+		}
+
+		batch->dma_bufs[i] = dma_buf;
+		batch->num_bufs++;
+
+		batch->dma_attachs[i] = dma_buf_attach(dma_buf, ge->dev);
+		if (IS_ERR(batch->dma_attachs[i])) {
+			dev_err(ge->dev, "failed to attach dma buf\n");
+			batch->dma_attachs[i] = NULL;
+			return -EINVAL;
+		}
+
+		batch->dma_mappings[i] = dma_buf_map_attachment(batch->dma_attachs[i],
+								batch->dma_dirs[i]);
+		if (IS_ERR(batch->dma_mappings[i])) {
+			dev_err(ge->dev, "failed to map dma buf\n");
+			batch->dma_mappings[i] = NULL;
+			return -EINVAL;
+		}
+
+		dma_addrs[i] = sg_dma_address(batch->dma_mappings[i]->sgl);
+		dev_dbg(ge->dev, "buffer is mapped to 0x%x\n", dma_addrs[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Everything that can fail is done before the batch gets queued, after
+ * that the only thing left is fd_install() so userspace always gets a
+ * handle to work that is running.
+ */
+static int mstar_ge_prepare_fence(struct dma_fence *fence, __s32 __user *out_fence,
+				  struct sync_file **sync_file)
+{
+	int fd;
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	if (put_user(fd, out_fence)) {
+		put_unused_fd(fd);
+		return -EFAULT;
+	}
+
+	*sync_file = sync_file_create(fence);
+	if (!*sync_file) {
+		put_unused_fd(fd);
+		return -ENOMEM;
+	}
+
+	return fd;
+}
+
+static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg, bool async)
 {
+	struct mstar_ge_queue_async __user *async_req = (void __user *) arg;
+	void __user *req_ptr = (void __user *) arg;
+	struct mstar_ge_queue_async async_args;
+	struct sync_file *sync_file = NULL;
 	struct mstar_ge_job_request req;
 	struct mstar_ge_opdata *ops;
 	struct mstar_ge_buf bufs[2];
-	struct mstar_ge_job *jobs[MSTAR_GE_MAX_JOBS];
-	enum dma_data_direction dma_dirs[2];
-	struct dma_buf *dma_bufs[2];
-	struct dma_buf_attachment *dma_attachs[2];
-	struct sg_table *dma_mappings[2];
+	struct mstar_ge_batch *batch;
 	dma_addr_t dma_addrs[2];
 	unsigned long tag = 0xAA55;
 	size_t opssz, bufssz;
+	long timeout;
+	int fd = -1;
 	int ret;
 	int i;
 
-	ret = copy_from_user(&req, (void*) arg, sizeof(req));
+	/* The async request points at the same request */
+	if (async) {
+		if (copy_from_user(&async_args, async_req, sizeof(async_args)))
+			return -EFAULT;
+		if (async_args.pad)
+			return -EINVAL;
+		req_ptr = u64_to_user_ptr(async_args.req);
+	}
+
+	ret = copy_from_user(&req, req_ptr, sizeof(req));
 	if (ret) {
 		dev_err(ge->dev, "Failed to get job request: %d, %lx\n", ret, arg);
 		return -EFAULT;
@@ -1374,13 +1924,15 @@ static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg)
 	ret = copy_from_user(ops, req.ops, opssz);
 	if (ret) {
 		dev_err(ge->dev, "Failed to copy ops from job request: %d\n", ret);
-		return -EFAULT;
+		ret = -EFAULT;
+		goto free_ops;
 	}
 
 	bufssz = sizeof(struct mstar_ge_buf) * req.num_bufs;
 	ret = copy_from_user(bufs, req.bufs, bufssz);
 	if (ret) {
 		dev_err(ge->dev, "Failed to copy bufs from job request: %d\n", ret);
+		ret = -EFAULT;
 		goto free_ops;
 	}
 
@@ -1393,39 +1945,16 @@ static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg)
 		}
 	}
 
-	/* Figure out the DMA directions */
-	if (req.num_bufs == 1)
-		dma_dirs[0] = DMA_FROM_DEVICE;
-	else {
-		dma_dirs[0] = DMA_TO_DEVICE;
-		dma_dirs[1] = DMA_FROM_DEVICE;
+	batch = mstar_ge_alloc_batch(ge);
+	if (!batch) {
+		ret = -ENOMEM;
+		goto free_ops;
 	}
 
 	/* Map the buffers */
-	for (i = 0; i < req.num_bufs; i++) {
-		struct mstar_ge_buf *buf = &bufs[i];
-
-		dma_bufs[i] = dma_buf_get(buf->fd);
-		if (IS_ERR(dma_bufs[i])) {
-			dev_err(ge->dev, "failed to get dma_buf for buffer\n");
-			return PTR_ERR(dma_bufs[i]);
-		}
-
-		dma_attachs[i] = dma_buf_attach(dma_bufs[i], ge->dev);
-		if (IS_ERR(dma_attachs[i])) {
-			dev_err(ge->dev, "failed to attach dma buf\n");
-			return PTR_ERR(dma_attachs[i]);
-		}
-
-		dma_mappings[i] = dma_buf_map_attachment(dma_attachs[i], dma_dirs[i]);
-		if (IS_ERR(dma_mappings[i])) {
-			dev_err(ge->dev, "failed to map dma buf\n");
-			return PTR_ERR(dma_mappings[i]);
-		}
-
-		dma_addrs[i] = sg_dma_address(dma_mappings[i]->sgl);
-		dev_dbg(ge->dev, "buffer is mapped to 0x%x\n", dma_addrs[i]);
-	}
+	ret = mstar_ge_batch_map(ge, batch, bufs, req.num_bufs, dma_addrs);
+	if (ret)
+		goto free_batch;
 
 	for (i = 0; i < req.num_ops; i++) {
 		struct mstar_ge_opdata *op = &ops[i];
@@ -1433,20 +1962,20 @@ static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg)
 
 		if (mstar_ge_validate_op(ge, op, i)) {
 			ret = -EFAULT;
-			goto free_ops;
+			goto free_batch;
 		}
 
 		/* If possible optimize the op */
 		if (mstar_ge_optimize_op(ge, op) && mstar_ge_validate_op(ge, op, i)) {
 			ret = -EFAULT;
-			goto free_ops;
+			goto free_batch;
 		}
 
-		job = mstar_ge_alloc_job(ge);
+		job = mstar_ge_alloc_job(ge, GFP_KERNEL);
 		if (!job) {
 			dev_err(ge->dev, "Failed to allocate job descriptor\n");
 			ret = -ENOMEM;
-			goto free_ops;
+			goto free_batch;
 		}
 
 		memcpy(&job->opdata, op, sizeof(job->opdata));
@@ -1462,31 +1991,55 @@ static long mstar_ge_ioctl_queue(struct mstar_ge *ge, unsigned long arg)
 			memcpy(&job->dst_cfg, &bufs[1].cfg, sizeof(job->dst_cfg));
 		}
 
-		dev_dbg(ge->dev, "Queuing job for op %d\n", i);
-		jobs[i] = job;
-		mstar_ge_queue_job(ge, job);
+		job->batch = batch;
+		batch->jobs[batch->num_jobs++] = job;
 	}
 
-	/* wait for everything to finish */
-	mstar_ge_wait_for_idle(ge);
+	if (async) {
+		fd = mstar_ge_prepare_fence(&batch->fence, &async_req->out_fence,
+					    &sync_file);
+		if (fd < 0) {
+			dev_err(ge->dev, "Failed to export batch fence: %d\n", fd);
+			ret = fd;
+			goto free_batch;
+		}
+	}
 
-	for (i = 0; i < req.num_ops; i++) {
-		kmem_cache_free(ge->jobs, jobs[i]);
+	dev_dbg(ge->dev, "Queuing batch of %d ops\n", batch->num_jobs);
+	mstar_ge_queue_batch(ge, batch);
+
+	if (async) {
+		fd_install(fd, sync_file->file);
+		ret = 0;
+		goto put_fence;
 	}
 
-	/* unmap everything, this needs to move once things are actually async */
-	for (i = 0; i < req.num_bufs; i++) {
-		dma_buf_unmap_attachment(dma_attachs[i], dma_mappings[i], dma_dirs[i]);
-		dma_buf_detach(dma_bufs[i], dma_attachs[i]);
-		dma_buf_put(dma_bufs[i]);
+	/* wait for this batch to finish */
+	timeout = dma_fence_wait_timeout(&batch->fence, false, HZ * 10);
+	if (timeout <= 0) {
+		dev_err(ge->dev, "timeout waiting for jobs to finish\n");
+		ret = -ETIMEDOUT;
+		goto put_fence;
 	}
 
-	ret = copy_to_user(req.tag, &tag, sizeof(tag));
-	if (ret) {
-		dev_err(ge->dev, "Failed to copy request tag to user: %d\n", ret);
-		return -EFAULT;
+	ret = batch->fence.error;
+	if (ret)
+		goto put_fence;
+
+	if (copy_to_user(req.tag, &tag, sizeof(tag))) {
+		dev_err(ge->dev, "Failed to copy request tag to user\n");
+		ret = -EFAULT;
 	}
 
+put_fence:
+	dma_fence_put(&batch->fence);
+	kfree(ops);
+	return ret;
+
+free_batch:
+	mstar_ge_batch_free_jobs(batch);
+	mstar_ge_batch_unmap(batch);
+	kfree(batch);
 free_ops:
 	kfree(ops);
 	return ret;
@@ -1505,7 +2058,9 @@ static long mstar_ge_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 	}
 		break;
 	case MSTAR_GE_IOCTL_QUEUE:
-		return mstar_ge_ioctl_queue(ge, arg);
+		return mstar_ge_ioctl_queue(ge, arg, false);
+	case MSTAR_GE_IOCTL_QUEUE_ASYNC:
+		return mstar_ge_ioctl_queue(ge, arg, true);
 	case MSTAR_GE_IOCTL_QUERY: {
 		unsigned long tag;
 
@@ -1532,10 +2087,14 @@ static int mstar_ge_target(struct device *dev,
 		unsigned long *freq, u32 flags)
 {
 	struct mstar_ge *ge = dev_get_drvdata(dev);
+	struct dev_pm_opp *opp;
 
-	dev_info(ge->dev, "%s:%d\n", __func__, __LINE__);
+	opp = devfreq_recommended_opp(dev, freq, flags);
+	if (IS_ERR(opp))
+		return PTR_ERR(opp);
+	dev_pm_opp_put(opp);
 
-	return 0;
+	return clk_set_rate(ge->clk, *freq);
 }
 
 static int mstar_ge_get_cur_freq(struct device *dev, unsigned long *freq)
@@ -1546,8 +2105,76 @@ static int mstar_ge_get_cur_freq(struct device *dev, unsigned long *freq)
 
 	return 0;
 }
+
+/*
+ * Busy time is everything between the first job of a run being queued and
+ * the interrupt for the last one, so the engine counts as busy while it
+ * works through a queue and idle otherwise.
+ */
+static int mstar_ge_get_dev_status(struct device *dev,
+		struct devfreq_dev_status *stat)
+{
+	struct mstar_ge *ge = dev_get_drvdata(dev);
+	unsigned long flags;
+	ktime_t now;
+
+	spin_lock_irqsave(&ge->lock, flags);
+	now = ktime_get();
+
+	stat->busy_time = ge->busy_us;
+	if (ge->inflight) {
+		stat->busy_time += ktime_us_delta(now, ge->busy_since);
+		ge->busy_since = now;
+	}
+	stat->total_time = ktime_us_delta(now, ge->stats_since);
+
+	ge->busy_us = 0;
+	ge->stats_since = now;
+	spin_unlock_irqrestore(&ge->lock, flags);
+
+	stat->current_frequency = clk_get_rate(ge->clk);
+
+	return 0;
+}
 #endif
 
+static ssize_t job_times_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct mstar_ge *ge = dev_get_drvdata(dev);
+	u32 trace[MSTAR_GE_JOB_TRACE_LEN];
+	unsigned int head, count, i;
+	unsigned long flags;
+	u64 jobs_done;
+	int len;
+
+	spin_lock_irqsave(&ge->lock, flags);
+	memcpy(trace, ge->job_trace, sizeof(trace));
+	head = ge->job_trace_head;
+	jobs_done = ge->jobs_done;
+	spin_unlock_irqrestore(&ge->lock, flags);
+
+	len = sysfs_emit(buf, "jobs: %llu\n", jobs_done);
+
+	/* oldest first, in us */
+	count = min_t(u64, jobs_done, MSTAR_GE_JOB_TRACE_LEN);
+	for (i = 0; i < count; i++) {
+		unsigned int idx = (head + MSTAR_GE_JOB_TRACE_LEN - count + i) %
+				   MSTAR_GE_JOB_TRACE_LEN;
+
+		len += sysfs_emit_at(buf, len, "%u\n", trace[idx]);
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(job_times);
+
+static struct attribute *mstar_ge_attrs[] = {
+	&dev_attr_job_times.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(mstar_ge);
+
 static int mstar_ge_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
@@ -1568,6 +2195,8 @@ static int mstar_ge_probe(struct platform_device *pdev)
 	spin_lock_init(&ge->lock);
 	INIT_LIST_HEAD(&ge->queue);
 	init_waitqueue_head(&ge->dma_wait);
+	spin_lock_init(&ge->fence_lock);
+	ge->fence_context = dma_fence_context_alloc(1);
 
 	ge->dev = dev;
 
@@ -1702,11 +2331,15 @@ static int mstar_ge_probe(struct platform_device *pdev)
 
 	ge->profile.target = mstar_ge_target;
 	ge->profile.get_cur_freq = mstar_ge_get_cur_freq;
+	ge->profile.get_dev_status = mstar_ge_get_dev_status;
 	ge->profile.initial_freq = clk_get_rate(ge->clk);
+	ge->profile.polling_ms = 50;
+	ge->stats_since = ktime_get();
 
 	ge->devfreq = devm_devfreq_add_device(dev,
 					      &ge->profile,
-					      DEVFREQ_GOV_USERSPACE,
+					      IS_ENABLED(CONFIG_DEVFREQ_GOV_SIMPLE_ONDEMAND) ?
+						DEVFREQ_GOV_SIMPLE_ONDEMAND : DEVFREQ_GOV_USERSPACE,
 					      NULL);
 	if (IS_ERR(ge->devfreq)) {
 		ret = PTR_ERR(ge->devfreq);
@@ -1766,6 +2399,7 @@ static struct platform_driver mstar_ge_driver = {
 		.name = DRIVER_NAME,
 		.of_match_table = mstar_ge_ids,
 		.pm = &mstar_ge_pm,
+		.dev_groups = mstar_ge_groups,
 	},
 };
 module_platform_driver(mstar_ge_driver);
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef _MSTAR_GE_H_
+#define _MSTAR_GE_H_
+
+#include <uapi/drm/mstar_ge.h>
+
+struct device;
+struct mstar_ge;
+
+struct mstar_ge *mstar_ge_get(struct device *dev);
+void mstar_ge_put(struct mstar_ge *ge);
+
+int mstar_ge_fill(struct mstar_ge *ge, const struct mstar_ge_buf_cfg *cfg, dma_addr_t addr,
+		  unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+		  const struct mstar_ge_color *color);
+int mstar_ge_copy(struct mstar_ge *ge, const struct mstar_ge_buf_cfg *cfg, dma_addr_t addr,
+		  unsigned int sx, unsigned int sy, unsigned int dx, unsigned int dy,
+		  unsigned int w, unsigned int h);
+int mstar_ge_sync(struct mstar_ge *ge);
+
+#endif /* _MSTAR_GE_H_ */
@@ -10,7 +10,9 @@
 #include <drm/drm_plane.h>
 #include <linux/component.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
 #include <linux/of_device.h>
 #include <linux/regmap.h>
@@ -51,7 +53,8 @@ static struct reg_field stretch_window_coordinate_v_field = REG_FIELD(0xd0, 0, 1
 //
 
 // triggers updating the registers
-static struct reg_field gop_commit_all_field = REG_FIELD(0x1fc, 8, 8);
+#define MSTAR_GOP_REG_COMMIT		0x1fc
+static struct reg_field gop_commit_all_field = REG_FIELD(MSTAR_GOP_REG_COMMIT, 8, 8);
 
 
 // window registers
@@ -110,6 +113,18 @@ struct mstar_gop {
 	struct drm_device *drm_device;
 	struct clk *fclk; /* vendor code says this is only needed when setting the palette */
 	const struct mstar_gop_data *data;
+	struct regmap *regmap;
+	struct list_head node;
+
+	/*
+	 * Serialises the register updates and the commit, async updates
+	 * can race with the commit tail of a nonblocking commit.
+	 */
+	struct mutex lock;
+	/* registers changed since the last commit, protected by lock */
+	bool dirty;
+	/* debugfs knob, dump the registers after each commit */
+	bool dump;
 
 	struct regmap_field *rst;
 	struct regmap_field *scan_type;
@@ -126,10 +141,28 @@ struct mstar_gop {
 	struct mstar_gop_window windows[];
 };
 
+static bool mstar_gop_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case MSTAR_GOP_REG_STATUS:
+	case MSTAR_GOP_REG_COMMIT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * The window registers are double buffered and only get latched by the
+ * commit so we can keep a copy of them. Updates then only touch the RIU
+ * for fields that actually changed and never need to read back.
+ */
 static const struct regmap_config mstar_gop_regmap_config = {
 	.reg_bits = 16,
 	.val_bits = 16,
 	.reg_stride = 4,
+	.cache_type = REGCACHE_MAPLE,
+	.volatile_reg = mstar_gop_volatile_reg,
 };
 
 static irqreturn_t mstar_gop_irq(int irq, void *data)
@@ -216,14 +249,42 @@ static void mstar_gop_dump(struct mstar_gop *gop)
 
 static void mstar_gop_reset(struct mstar_gop *gop)
 {
+	/* Everything goes back to the defaults so don't cache anything from before */
+	regcache_cache_bypass(gop->regmap, true);
 	regmap_field_force_write(gop->rst, 1);
 	mdelay(10);
 	regmap_field_force_write(gop->rst, 0);
 	mdelay(10);
+	regcache_cache_bypass(gop->regmap, false);
 
 	mstar_gop_dump(gop);
 }
 
+static void mstar_gop_flush(struct mstar_gop *gop)
+{
+	mutex_lock(&gop->lock);
+
+	if (gop->dirty) {
+		regmap_field_force_write(gop->commit_all, 1);
+		gop->dirty = false;
+
+		if (gop->dump)
+			mstar_gop_dump(gop);
+	}
+
+	mutex_unlock(&gop->lock);
+}
+
+/* Called once per atomic commit after all of the planes have been updated */
+void mstar_gop_flush_all(struct mstar_drv *drv)
+{
+	struct mstar_gop *gop;
+
+	list_for_each_entry(gop, &drv->gops, node)
+		mstar_gop_flush(gop);
+}
+EXPORT_SYMBOL_GPL(mstar_gop_flush_all);
+
 static int gop_ssd20xd_gop0_drm_color_to_gop(u32 fourcc)
 {
 	switch(fourcc){
@@ -291,7 +352,9 @@ static void gop_plane_atomic_update(struct drm_plane *plane,
 	struct mstar_gop *gop = window->gop;
 	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
 	struct drm_framebuffer *fb = new_state->fb;
+	struct regmap_field_batch batch;
 	struct drm_gem_dma_object *gem;
+	bool change;
 	u32 addr;
 
 	fb = new_state->fb;
@@ -302,44 +365,97 @@ static void gop_plane_atomic_update(struct drm_plane *plane,
 	if (!gem)
 		return;
 
+	mutex_lock(&gop->lock);
+
+	/* Lots of the fields share registers, collect them up and write them in one go */
+	regmap_field_batch_init(&batch, gop->regmap);
+
 	// global window first
 	/* Not sure why but the output colour space needs to be YUV */
-	regmap_field_force_write(gop->colorspace, 1);
+	regmap_field_batch_write(&batch, gop->colorspace, 1);
 
-	regmap_field_write(gop->stretch_window_size_h,
-			   new_state->crtc_w >> STRETCH_WINDOW_SIZE_H_SHIFT);
-	regmap_field_write(gop->stretch_window_size_v, new_state->crtc_h);
-	regmap_field_write(gop->stretch_window_coordinate_h, new_state->crtc_x);
-	regmap_field_write(gop->stretch_window_coordinate_v, new_state->crtc_y);
+	regmap_field_batch_write(&batch, gop->stretch_window_size_h,
+			new_state->crtc_w >> STRETCH_WINDOW_SIZE_H_SHIFT);
+	regmap_field_batch_write(&batch, gop->stretch_window_size_v, new_state->crtc_h);
+	regmap_field_batch_write(&batch, gop->stretch_window_coordinate_h, new_state->crtc_x);
+	regmap_field_batch_write(&batch, gop->stretch_window_coordinate_v, new_state->crtc_y);
 
 	// gop window
 
-	regmap_field_write(window->en, new_state->crtc ? 1 : 0);
-	regmap_field_write(window->format, gop->data->drm_color_to_gop(fb->format->format));
+	regmap_field_batch_write(&batch, window->en, new_state->crtc ? 1 : 0);
+	regmap_field_batch_write(&batch, window->format, gop->data->drm_color_to_gop(fb->format->format));
 
-	regmap_field_write(window->hstart, new_state->crtc_x);
-	regmap_field_write(window->vstart, new_state->crtc_y);
+	regmap_field_batch_write(&batch, window->hstart, new_state->crtc_x);
+	regmap_field_batch_write(&batch, window->vstart, new_state->crtc_y);
 
 	// This seems to be the same as pitch?
-	regmap_field_write(window->hend, fb->pitches[0] >> gop->data->addr_shift);
-	regmap_field_write(window->vend, new_state->crtc_y + new_state->crtc_h);
+	regmap_field_batch_write(&batch, window->hend, fb->pitches[0] >> gop->data->addr_shift);
+	regmap_field_batch_write(&batch, window->vend, new_state->crtc_y + new_state->crtc_h);
+
+	regmap_field_batch_write(&batch, window->pitch, fb->pitches[0] >> gop->data->addr_shift);
+
+	addr = gem->dma_addr >> gop->data->addr_shift;
+
+	regmap_field_batch_write(&batch, window->addrh, addr >> 16);
+	regmap_field_batch_write(&batch, window->addrl, addr);
+
+	regmap_field_batch_flush(&batch, &change);
+	gop->dirty |= change;
 
-	regmap_field_write(window->pitch, fb->pitches[0] >> gop->data->addr_shift);
+	mutex_unlock(&gop->lock);
 
-	addr = gem->dma_addr >> window->gop->data->addr_shift;
+	/* The commit happens in mstar_gop_flush_all() */
+}
+
+/*
+ * Moving a visible window, i.e. the cursor, doesn't need to wait for
+ * the next vblank. Swapping the buffer does: the new address only gets
+ * latched at vblank and nothing tells us when that has happened, so the
+ * old buffer could be released while it is still being scanned out.
+ */
+static int gop_plane_atomic_async_check(struct drm_plane *plane,
+					struct drm_atomic_state *state)
+{
+	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
+
+	if (!plane->state->fb || !new_state->crtc ||
+	    plane->state->crtc != new_state->crtc)
+		return -EINVAL;
+
+	if (plane->state->fb != new_state->fb)
+		return -EINVAL;
+
+	return gop_plane_atomic_check(plane, state);
+}
+
+static void gop_plane_atomic_async_update(struct drm_plane *plane,
+					  struct drm_atomic_state *state)
+{
+	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
+	struct mstar_gop_window *window = plane_to_gop_window(plane);
 
-	regmap_field_write(window->addrh, addr >> 16);
-	regmap_field_write(window->addrl, addr);
+	gop_plane_atomic_update(plane, state);
 
-	regmap_field_force_write(window->gop->commit_all, 1);
+	/* Async updates skip the crtc flush so commit now */
+	mstar_gop_flush(window->gop);
 
-	mstar_gop_dump(window->gop);
+	/* The fb is the same, only the position changes */
+	plane->state->crtc_x = new_state->crtc_x;
+	plane->state->crtc_y = new_state->crtc_y;
+	plane->state->crtc_w = new_state->crtc_w;
+	plane->state->crtc_h = new_state->crtc_h;
+	plane->state->src_x = new_state->src_x;
+	plane->state->src_y = new_state->src_y;
+	plane->state->src_w = new_state->src_w;
+	plane->state->src_h = new_state->src_h;
 }
 
 static const struct drm_plane_helper_funcs gop_plane_helper_funcs = {
 	.prepare_fb = drm_gem_plane_helper_prepare_fb,
 	.atomic_check = gop_plane_atomic_check,
 	.atomic_update = gop_plane_atomic_update,
+	.atomic_async_check = gop_plane_atomic_async_check,
+	.atomic_async_update = gop_plane_atomic_async_update,
 };
 
 static const struct drm_plane_funcs gop_plane_funcs = {
@@ -361,9 +477,11 @@ static int mstar_gop_bind(struct device *dev, struct device *master,
 {
 	struct mstar_gop *gop = dev_get_drvdata(dev);
 	struct drm_device *drm_device = data;
+	struct mstar_drv *drv = drm_device->dev_private;
 	int i, ret;
 
 	gop->drm_device = drm_device;
+	list_add_tail(&gop->node, &drv->gops);
 
 	for (i = 0; i < gop->data->num_windows; i++){
 		struct mstar_gop_window *window = &gop->windows[i];
@@ -387,6 +505,9 @@ static int mstar_gop_bind(struct device *dev, struct device *master,
 
 static void mstar_gop_unbind(struct device *dev, struct device *master, void *data)
 {
+	struct mstar_gop *gop = dev_get_drvdata(dev);
+
+	list_del(&gop->node);
 }
 
 static const struct component_ops mstar_gop_ops = {
@@ -394,6 +515,21 @@ static const struct component_ops mstar_gop_ops = {
 	.unbind	= mstar_gop_unbind,
 };
 
+static void mstar_gop_debugfs_remove(void *data)
+{
+	debugfs_remove_recursive(data);
+}
+
+static int mstar_gop_debugfs_init(struct mstar_gop *gop)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(gop->dev), NULL);
+	debugfs_create_bool("dump", 0644, dir, &gop->dump);
+
+	return devm_add_action_or_reset(gop->dev, mstar_gop_debugfs_remove, dir);
+}
+
 static int mstar_gop_probe(struct platform_device *pdev)
 {
 	const struct mstar_gop_data *match_data;
@@ -413,6 +549,7 @@ static int mstar_gop_probe(struct platform_device *pdev)
 
 	gop->data = match_data;
 	gop->dev = dev;
+	mutex_init(&gop->lock);
 
 	regs = devm_platform_ioremap_resource(pdev, 0);
 	if (IS_ERR(regs))
@@ -421,6 +558,7 @@ static int mstar_gop_probe(struct platform_device *pdev)
 	regmap = devm_regmap_init_mmio(dev, regs, &mstar_gop_regmap_config);
 	if(IS_ERR(regmap))
 		return PTR_ERR(regmap);
+	gop->regmap = regmap;
 
 	gop->rst = regmap_field_alloc(regmap, gop_rst_field);
 	gop->scan_type = regmap_field_alloc(regmap, gop_scan_type_field);
@@ -483,6 +621,10 @@ static int mstar_gop_probe(struct platform_device *pdev)
 
 	mstar_gop_reset(gop);
 
+	ret = mstar_gop_debugfs_init(gop);
+	if (ret)
+		return ret;
+
 	return component_add(&pdev->dev, &mstar_gop_ops);
 }
 
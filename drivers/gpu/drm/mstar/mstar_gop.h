@@ -45,3 +45,7 @@
 
 #define MSTAR_GOP_BANK_1		0x200
 #define MSTAR_GOP_REG_FORMAT		(MSTAR_GOP_BANK_1 + 0x00)
+
+struct mstar_drv;
+
+void mstar_gop_flush_all(struct mstar_drv *drv);
@@ -1,17 +1,35 @@
 #include <drm/drm_atomic.h>
 #include <drm/drm_atomic_helper.h>
+#include <drm/drm_fb_dma_helper.h>
 #include <drm/drm_fourcc.h>
+#include <drm/drm_framebuffer.h>
+#include <drm/drm_gem_atomic_helper.h>
 #include <drm/drm_plane.h>
 #include <linux/component.h>
+#include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/regmap.h>
 
+#include "mstar_drm.h"
+#include "mstar_mop.h"
+
 #define DRIVER_NAME "mstar-mop"
 
 #define ADDR_SHIFT	4
 
+/*
+ * The scaling factors seem to be source size over destination size
+ * with 12 fractional bits, so 0x1000 is 1:1 and the 13 bit field tops
+ * out just under 2:1 down scaling.
+ */
+#define SCALE_SHIFT	12
+#define SCALE_MAX	0x1fff
+/* drm wants the limits as 16.16 src/dst */
+#define MOP_MIN_SCALE	(DRM_PLANE_NO_SCALING / 16)
+#define MOP_MAX_SCALE	(SCALE_MAX << (16 - SCALE_SHIFT))
+
 static const uint32_t mop_formats[] = {
 	DRM_FORMAT_NV12,
 };
@@ -55,18 +73,34 @@ struct mstar_mop {
 	struct regmap_field *gw_hsize;
 	struct regmap_field *gw_vsize;
 	struct regmap_field *commit_all;
+	struct list_head node;
+
+	/* registers changed since the last commit */
+	bool dirty;
+	/* debugfs knob, dump the windows after each commit */
+	bool dump;
 	struct mstar_mop_window windows[];
 };
 
+#define REG_COMMIT	0x1fc
+
 static const struct reg_field swrst_field = REG_FIELD(0x0, 0, 0);
 static const struct reg_field gw_hsize_field = REG_FIELD(0x1c, 0, 12);
 static const struct reg_field gw_vsize_field = REG_FIELD(0x20, 0, 12);
-static const struct reg_field commit_all_field = REG_FIELD(0x1fc, 8, 8);
+static const struct reg_field commit_all_field = REG_FIELD(REG_COMMIT, 8, 8);
+
+static bool mstar_mop_volatile_reg(struct device *dev, unsigned int reg)
+{
+	return reg == REG_COMMIT;
+}
 
+/* Same as the GOP, the window registers only get latched by the commit */
 static const struct regmap_config mstar_mop_regmap_config = {
 	.reg_bits = 16,
 	.val_bits = 16,
 	.reg_stride = 4,
+	.cache_type = REGCACHE_MAPLE,
+	.volatile_reg = mstar_mop_volatile_reg,
 };
 
 static void mstar_mop_dump_window(struct device *dev, struct mstar_mop_window *win)
@@ -120,28 +154,123 @@ static void mstar_mop_dump_window(struct device *dev, struct mstar_mop_window *w
 		      scaleh, scalev);
 }
 
+static void mstar_mop_write(struct mstar_mop *mop, struct regmap_field *field,
+			    unsigned int val)
+{
+	bool change = false;
+
+	regmap_field_update_bits_base(field, ~0, val, &change, false, false);
+	mop->dirty |= change;
+}
+
+/* Called once per atomic commit after all of the planes have been updated */
+void mstar_mop_flush_all(struct mstar_drv *drv)
+{
+	struct mstar_mop *mop;
+	int i;
+
+	list_for_each_entry(mop, &drv->mops, node) {
+		if (!mop->dirty)
+			continue;
+
+		regmap_field_force_write(mop->commit_all, 1);
+		regmap_field_force_write(mop->commit_all, 0);
+		mop->dirty = false;
+
+		if (mop->dump)
+			for (i = 0; i < mop->data->num_windows; i++)
+				mstar_mop_dump_window(mop->dev, &mop->windows[i]);
+	}
+}
+EXPORT_SYMBOL_GPL(mstar_mop_flush_all);
+
 static int mop_plane_atomic_check(struct drm_plane *plane,
 				    struct drm_atomic_state *state)
 {
+	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
+	struct drm_framebuffer *fb = new_state->fb;
+	struct drm_crtc_state *crtc_state;
+	int ret;
+
+	if (!fb || !new_state->crtc)
+		return 0;
+
+	crtc_state = drm_atomic_get_new_crtc_state(state, new_state->crtc);
+
+	ret = drm_atomic_helper_check_plane_state(new_state, crtc_state,
+						  MOP_MIN_SCALE, MOP_MAX_SCALE,
+						  true, true);
+	if (ret)
+		return ret;
+
+	if (!new_state->visible)
+		return 0;
+
+	/* The addresses and pitch are in units of 16 bytes */
+	if (!IS_ALIGNED(fb->pitches[0], BIT(ADDR_SHIFT)) ||
+	    !IS_ALIGNED(drm_fb_dma_get_gem_addr(fb, new_state, 0), BIT(ADDR_SHIFT)) ||
+	    !IS_ALIGNED(drm_fb_dma_get_gem_addr(fb, new_state, 1), BIT(ADDR_SHIFT)))
+		return -EINVAL;
+
 	return 0;
 }
 
+static unsigned int mop_plane_scale(unsigned int src, unsigned int dst)
+{
+	return min_t(u32, DIV_ROUND_CLOSEST(src << SCALE_SHIFT, dst), SCALE_MAX);
+}
+
+/*
+ * The buffers can come straight from a decoder via a dma-buf, the gem
+ * dma helpers already import those as long as they are contiguous and
+ * prepare_fb waits for the decoder to be done with them.
+ */
 static void mstar_mop_plane_atomic_update(struct drm_plane *plane,
 				    struct drm_atomic_state *state)
 {
 	struct drm_plane_state *new_state = drm_atomic_get_new_plane_state(state, plane);
 	struct mstar_mop_window *window = plane_to_mop_window(plane);
+	struct drm_framebuffer *fb = new_state->fb;
 	struct mstar_mop *mop = window->mop;
+	unsigned int srcw, srch, dstw, dsth;
+	dma_addr_t yaddr, caddr;
+
+	if (!fb || !new_state->crtc || !new_state->visible) {
+		mstar_mop_write(mop, window->en, 0);
+		return;
+	}
+
+	srcw = drm_rect_width(&new_state->src) >> 16;
+	srch = drm_rect_height(&new_state->src) >> 16;
+	dstw = drm_rect_width(&new_state->dst);
+	dsth = drm_rect_height(&new_state->dst);
+
+	yaddr = drm_fb_dma_get_gem_addr(fb, new_state, 0) >> ADDR_SHIFT;
+	caddr = drm_fb_dma_get_gem_addr(fb, new_state, 1) >> ADDR_SHIFT;
+
+	mstar_mop_write(mop, window->yaddrl, yaddr);
+	mstar_mop_write(mop, window->yaddrh, yaddr >> 16);
+	mstar_mop_write(mop, window->caddrl, caddr);
+	mstar_mop_write(mop, window->caddrh, caddr >> 16);
 
-	regmap_field_write(window->en, new_state->crtc ? 1 : 0);
+	mstar_mop_write(mop, window->hst, new_state->dst.x1);
+	mstar_mop_write(mop, window->hend, new_state->dst.x2);
+	mstar_mop_write(mop, window->vst, new_state->dst.y1);
+	mstar_mop_write(mop, window->vend, new_state->dst.y2);
 
-	regmap_field_force_write(mop->commit_all, 1);
-	regmap_field_force_write(mop->commit_all, 0);
+	mstar_mop_write(mop, window->pitch, fb->pitches[0] >> ADDR_SHIFT);
+	mstar_mop_write(mop, window->src_width, srcw);
+	mstar_mop_write(mop, window->src_height, srch);
+	mstar_mop_write(mop, window->scale_h, mop_plane_scale(srcw, dstw));
+	mstar_mop_write(mop, window->scale_v, mop_plane_scale(srch, dsth));
 
-	mstar_mop_dump_window(mop->dev, window);
+	mstar_mop_write(mop, window->en, 1);
+
+	/* The commit happens in mstar_mop_flush_all() */
 }
 
 static const struct drm_plane_helper_funcs mop_plane_helper_funcs = {
+	.prepare_fb = drm_gem_plane_helper_prepare_fb,
 	.atomic_check = mop_plane_atomic_check,
 	.atomic_update = mstar_mop_plane_atomic_update,
 };
@@ -160,6 +289,7 @@ static int mstar_mop_bind(struct device *dev, struct device *master,
 {
 	struct mstar_mop *mop = dev_get_drvdata(dev);
 	struct drm_device *drm_device = data;
+	struct mstar_drv *drv = drm_device->dev_private;
 	int i, ret;
 
 	for(i = 0; i < mop->data->num_windows; i++) {
@@ -167,7 +297,7 @@ static int mstar_mop_bind(struct device *dev, struct device *master,
 
 		ret = drm_universal_plane_init(drm_device,
 					     &window->drm_plane,
-					     0,
+					     1,
 					     &mop_plane_funcs,
 					     mop_formats,
 					     ARRAY_SIZE(mop_formats),
@@ -180,6 +310,8 @@ static int mstar_mop_bind(struct device *dev, struct device *master,
 		drm_plane_helper_add(&window->drm_plane, &mop_plane_helper_funcs);
 	}
 
+	list_add_tail(&mop->node, &drv->mops);
+
 	return 0;
 }
 
@@ -189,6 +321,8 @@ static void mstar_mop_unbind(struct device *dev, struct device *master,
 	struct mstar_mop *mop = dev_get_drvdata(dev);
 	int i;
 
+	list_del(&mop->node);
+
 	for(i = 0; i < mop->data->num_windows; i++)
 		drm_plane_cleanup(&mop->windows[i].drm_plane);
 }
@@ -198,6 +332,21 @@ static const struct component_ops mstar_mop_component_ops = {
 	.unbind	= mstar_mop_unbind,
 };
 
+static void mstar_mop_debugfs_remove(void *data)
+{
+	debugfs_remove_recursive(data);
+}
+
+static int mstar_mop_debugfs_init(struct mstar_mop *mop)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(mop->dev), NULL);
+	debugfs_create_bool("dump", 0644, dir, &mop->dump);
+
+	return devm_add_action_or_reset(mop->dev, mstar_mop_debugfs_remove, dir);
+}
+
 static int mstar_mop_probe(struct platform_device *pdev)
 {
 	const struct mstar_mop_data *match_data;
@@ -271,8 +420,8 @@ static int mstar_mop_probe(struct platform_device *pdev)
 		window->vst = devm_regmap_field_alloc(dev, regmap, vst_field);
 		window->vend = devm_regmap_field_alloc(dev, regmap, vend_field);
 		window->pitch = devm_regmap_field_alloc(dev, regmap, pitch_field);
-		window->src_height = devm_regmap_field_alloc(dev, regmap, srcw_field);
-		window->src_width = devm_regmap_field_alloc(dev, regmap, srch_field);
+		window->src_width = devm_regmap_field_alloc(dev, regmap, srcw_field);
+		window->src_height = devm_regmap_field_alloc(dev, regmap, srch_field);
 		window->scale_h = devm_regmap_field_alloc(dev, regmap, scaleh_field);
 		window->scale_v = devm_regmap_field_alloc(dev, regmap, scalev_field);
 		mstar_mop_dump_window(dev, window);
@@ -280,6 +429,10 @@ static int mstar_mop_probe(struct platform_device *pdev)
 
 	dev_set_drvdata(dev, mop);
 
+	ret = mstar_mop_debugfs_init(mop);
+	if (ret)
+		return ret;
+
 	return component_add(&pdev->dev, &mstar_mop_component_ops);
 }
 
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef _MSTAR_MOP_H_
+#define _MSTAR_MOP_H_
+
+struct mstar_drv;
+
+void mstar_mop_flush_all(struct mstar_drv *drv);
+
+#endif /* _MSTAR_MOP_H_ */
@@ -10,6 +10,8 @@
 #include <linux/regmap.h>
 
 #include "mstar_drm.h"
+#include "mstar_gop.h"
+#include "mstar_mop.h"
 #include "mstar_ttl.h"
 #include "mstar_top.h"
 
@@ -215,6 +217,14 @@ static void mstar_op2_atomic_enable(struct drm_crtc *crtc, struct drm_atomic_sta
 static void mstar_op2_atomic_disable(struct drm_crtc *crtc, struct drm_atomic_state *state)
 {
 	drm_crtc_vblank_off(crtc);
+
+	/* There won't be another vblank to send the event from */
+	spin_lock_irq(&crtc->dev->event_lock);
+	if (crtc->state->event && !crtc->state->active) {
+		drm_crtc_send_vblank_event(crtc, crtc->state->event);
+		crtc->state->event = NULL;
+	}
+	spin_unlock_irq(&crtc->dev->event_lock);
 }
 
 static void mstar_op2_atomic_flush(struct drm_crtc *crtc, struct drm_atomic_state *state)
@@ -222,6 +232,10 @@ static void mstar_op2_atomic_flush(struct drm_crtc *crtc, struct drm_atomic_stat
 	struct drm_crtc_state *crtc_state = drm_atomic_get_new_crtc_state(state, crtc);
 	struct drm_pending_vblank_event *event = crtc_state->event;
 
+	/* All of the plane updates are in, latch them at the next vblank */
+	mstar_gop_flush_all(crtc->dev->dev_private);
+	mstar_mop_flush_all(crtc->dev->dev_private);
+
 	if (event) {
 		crtc_state->event = NULL;
 
@@ -168,6 +168,8 @@ static const struct reg_field dma_command_data_field[] = {
 	REG_FIELD(REG_DMA_CMDDAT4_5, 0, 15),
 	REG_FIELD(REG_DMA_CMDDAT6_7, 0, 15),
 };
+/* Bytes that can be sent from the command registers before the data phase */
+#define DMA_COMMAND_MAX		(ARRAY_SIZE(dma_command_data_field) * 2)
 static const struct reg_field dma_commandlen_field = REG_FIELD(REG_DMA_CMDLEN, 0, 3);
 static const struct reg_field dma_datalen_field = REG_FIELD(REG_DMA_DATALEN, 0, 15);
 static const struct reg_field dma_tcl_field = REG_FIELD(REG_DMA_TCL, 0, 15);
@@ -225,7 +227,7 @@ struct msc313e_i2c {
 	struct regmap_field *dma_stopdis;
 	/* ack a dma complete irq */
 	struct regmap_field *dma_txr_done;
-	//struct regmap_field *dma_command_data;
+	struct regmap_field *dma_command_data[ARRAY_SIZE(dma_command_data_field)];
 	struct regmap_field *dma_command_len;
 	struct regmap_field *dma_data_len;
 	struct regmap_field *dma_tcl;
@@ -236,6 +238,13 @@ struct msc313e_i2c {
 	struct regmap_field *dma_retrigger;
 	struct regmap_field *dma_state;
 
+	/*
+	 * Short messages are bounced through here, it stays mapped
+	 * so they don't pay for mapping and unmapping every time.
+	 */
+	u8 *bounce;
+	dma_addr_t bounce_dma;
+
 	/* irq stuff */
 	wait_queue_head_t wait;
 	struct regmap_field *intstat;
@@ -328,20 +337,43 @@ static int msc313e_i2c_waitforidle(struct msc313e_i2c *i2c, unsigned wantedint)
 	return 0;
 }
 
-static int msc313_i2c_xfer_dma(struct msc313e_i2c *i2c, struct i2c_msg *msg, u8 *dma_buf, bool last)
+/* Messages up to this long use the bounce buffer */
+#define DMA_BOUNCE_LEN		L1_CACHE_BYTES
+
+/*
+ * Do a DMA transfer of msg. If cmd_len isn't zero the bytes in cmd are
+ * written first from the command registers and msg then follows after
+ * a repeated start, that makes the usual write register address then
+ * read the value sequence a single transfer.
+ */
+static int msc313_i2c_xfer_dma(struct msc313e_i2c *i2c, const u8 *cmd, unsigned int cmd_len,
+			       struct i2c_msg *msg, bool last)
 {
 	bool read = msg->flags & I2C_M_RD;
+	bool bounce = msg->len <= DMA_BOUNCE_LEN;
 	unsigned long flags;
 	enum dma_data_direction dir = read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
 	dma_addr_t dma_addr;
-	int ret = 0;
-
-	//printk("dma i2c addr: %02x, read: %d, len: %d, %px\n", msg->addr, read, msg->len, dma_buf);
+	u8 *dma_buf = NULL;
+	int i, ret = 0;
 
-	dma_addr = dma_map_single(i2c->dev, dma_buf, msg->len, dir);
-	if (dma_mapping_error(i2c->dev, dma_addr)) {
-		return -ENOMEM;
-	};
+	//printk("dma i2c addr: %02x, read: %d, len: %d, cmd len: %d\n", msg->addr, read, msg->len, cmd_len);
+
+	if (bounce) {
+		dma_addr = i2c->bounce_dma;
+		if (!read)
+			memcpy(i2c->bounce, msg->buf, msg->len);
+	} else {
+		dma_buf = i2c_get_dma_safe_msg_buf(msg, 0);
+		if (!dma_buf)
+			return -ENOMEM;
+
+		dma_addr = dma_map_single(i2c->dev, dma_buf, msg->len, dir);
+		if (dma_mapping_error(i2c->dev, dma_addr)) {
+			i2c_put_dma_safe_msg_buf(dma_buf, msg, false);
+			return -ENOMEM;
+		}
+	}
 
 	/* controller setup */
 	regmap_field_write(i2c->endma, 1);
@@ -352,10 +384,20 @@ static int msc313_i2c_xfer_dma(struct msc313e_i2c *i2c, struct i2c_msg *msg, u8
 	regmap_field_write(i2c->dma_slave_addr, msg->addr);
 	regmap_field_write(i2c->dma_10bit_en, (msg->flags & I2C_M_TEN) ? 1 : 0);
 
+	/* command phase, two bytes per register, first byte in the low half */
+	for (i = 0; i < cmd_len; i += 2) {
+		unsigned int cmd_data = cmd[i];
+
+		if (i + 1 < cmd_len)
+			cmd_data |= cmd[i + 1] << 8;
+
+		regmap_field_write(i2c->dma_command_data[i / 2], cmd_data);
+	}
+
 	/* transfer setup */
 	regmap_field_write(i2c->dma_addrl, dma_addr);
 	regmap_field_write(i2c->dma_addrh, dma_addr >> 16);
-	regmap_field_write(i2c->dma_command_len, 0);
+	regmap_field_write(i2c->dma_command_len, cmd_len);
 	regmap_field_write(i2c->dma_data_len, msg->len);
 
 	/* trigger and wait */
@@ -371,13 +413,34 @@ static int msc313_i2c_xfer_dma(struct msc313e_i2c *i2c, struct i2c_msg *msg, u8
 		ret = -ETIMEDOUT;
 	}
 
-	dma_unmap_single(i2c->dev, dma_addr, msg->len, dir);
-
-	i2c_put_dma_safe_msg_buf(dma_buf, msg, true);
+	if (bounce) {
+		if (read && !ret)
+			memcpy(msg->buf, i2c->bounce, msg->len);
+	} else {
+		dma_unmap_single(i2c->dev, dma_addr, msg->len, dir);
+		i2c_put_dma_safe_msg_buf(dma_buf, msg, !ret);
+	}
 
 	return ret;
 }
 
+/*
+ * Can msgs[i] be sent from the command registers ahead of msgs[i + 1]
+ * in a single DMA transfer?
+ */
+static bool msc313_i2c_can_combine(struct i2c_msg msgs[], int i, int num)
+{
+	struct i2c_msg *wr = &msgs[i], *rd = &msgs[i + 1];
+
+	if (i + 1 >= num)
+		return false;
+
+	return !(wr->flags & I2C_M_RD) && (rd->flags & I2C_M_RD) &&
+	       wr->len && wr->len <= DMA_COMMAND_MAX && rd->len &&
+	       wr->addr == rd->addr &&
+	       (wr->flags & I2C_M_TEN) == (rd->flags & I2C_M_TEN);
+}
+
 static int msc313_i2c_rxbyte(struct msc313e_i2c *i2c, bool last)
 {
 	unsigned long flags;
@@ -498,7 +561,13 @@ static int msc313_i2c_xfer_pio(struct msc313e_i2c *i2c, struct i2c_msg *msg, boo
 	return ret;
 }
 
-#define DISABLE_DMA
+/*
+ * The DMA engine still needs validating on more boards so it's opt-in,
+ * without it everything goes byte by byte.
+ */
+static bool use_dma;
+module_param(use_dma, bool, 0444);
+MODULE_PARM_DESC(use_dma, "Use DMA for longer messages and write-then-read pairs");
 
 #define DMA_THRESHOLD 8
 
@@ -537,13 +606,20 @@ static int msc313_i2c_xfer(struct i2c_adapter *i2c_adap, struct i2c_msg msgs[],
 		struct i2c_msg *msg = &msgs[i];
 		bool first = i == 0;
 		bool last = i + 1 == num;
-#ifndef DISABLE_DMA
-		u8 *dma_buf = i2c_get_dma_safe_msg_buf(msg, DMA_THRESHOLD);
+		if (bus->bounce && msc313_i2c_can_combine(msgs, i, num)) {
+			ret = msc313_i2c_xfer_dma(bus, msg->buf, msg->len, &msgs[i + 1], i + 2 == num);
+			if (ret)
+				goto abort;
+
+			txed += 2;
+			i++;
+			udelay(20);
+			continue;
+		}
 
-		if(dma_buf)
-			ret = msc313_i2c_xfer_dma(bus, msg, dma_buf, last);
+		if (bus->bounce && msg->len >= DMA_THRESHOLD)
+			ret = msc313_i2c_xfer_dma(bus, NULL, 0, msg, last);
 		else
-#endif
 			ret = msc313_i2c_xfer_pio(bus, msg, first, last);
 
 		if(ret)
@@ -685,8 +761,10 @@ static int msc313e_i2c_probe(struct platform_device *pdev)
 	msc313ei2c->dma_read =  devm_regmap_field_alloc(dev, msc313ei2c->regmap, dma_read_field);
 	msc313ei2c->dma_stopdis =  devm_regmap_field_alloc(dev, msc313ei2c->regmap, dma_stopdis_field);
 	msc313ei2c->dma_txr_done =  devm_regmap_field_alloc(dev, msc313ei2c->regmap, dma_txrdone_field);
-	//devm_regmap_field_bulk_alloc(dev, msc313ei2c->regmap,
-	//		&msc313ei2c->dma_command_data, dma_command_data_field, ARRAY_SIZE(dma_command_data_field));
+	ret = devm_regmap_field_bulk_alloc(dev, msc313ei2c->regmap,
+			msc313ei2c->dma_command_data, dma_command_data_field, ARRAY_SIZE(dma_command_data_field));
+	if (ret)
+		return ret;
 	msc313ei2c->dma_command_len = devm_regmap_field_alloc(&pdev->dev, msc313ei2c->regmap, dma_commandlen_field);
 	msc313ei2c->dma_data_len = devm_regmap_field_alloc(&pdev->dev, msc313ei2c->regmap, dma_datalen_field);
 	msc313ei2c->dma_tcl = devm_regmap_field_alloc(&pdev->dev, msc313ei2c->regmap, dma_tcl_field);
@@ -700,6 +778,14 @@ static int msc313e_i2c_probe(struct platform_device *pdev)
 	/* bus recovery */
 	msc313ei2c->sdai =  devm_regmap_field_alloc(dev, msc313ei2c->regmap, sdai_field);
 
+	/* No bounce buffer means no DMA */
+	if (use_dma) {
+		msc313ei2c->bounce = dmam_alloc_coherent(dev, DMA_BOUNCE_LEN,
+				&msc313ei2c->bounce_dma, GFP_KERNEL);
+		if (!msc313ei2c->bounce)
+			return -ENOMEM;
+	}
+
 	irq = irq_of_parse_and_map(pdev->dev.of_node, 0);
 	if (!irq)
 		return -EINVAL;
@@ -5,6 +5,7 @@
 
 #include <linux/bitops.h>
 #include <linux/clk.h>
+#include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/io.h>
 #include <linux/interrupt.h>
@@ -14,7 +15,9 @@
 #include <linux/of_irq.h>
 #include <linux/platform_device.h>
 #include <linux/wait.h>
+#include <linux/iio/buffer.h>
 #include <linux/iio/iio.h>
+#include <linux/iio/kfifo_buf.h>
 #include <linux/gpio/driver.h>
 #include <linux/pinctrl/pinconf-generic.h>
 #include <linux/pinctrl/pinctrl.h>
@@ -41,6 +44,10 @@
 #define REG_VREF_SEL		0x64
 #define REG_CH1_UPB		0x80
 #define REG_CH1_LOB		0xc0
+#define REG_CH_UPB(ch)		(REG_CH1_UPB + ((ch) * 4))
+#define REG_CH_LOB(ch)		(REG_CH1_LOB + ((ch) * 4))
+
+#define SAR_MAX_VAL		0x3ff
 
 #define REG_PMSLEEP_PD		0xbc
 #define REG_PMSLEEP_TS_PD	BIT(2)
@@ -331,7 +338,16 @@ struct msc313e_sar {
 
 	int wakeirq_sar, wakeirq_gpio;
 
+	/* last channel of the buffered scan, its interrupt ends a round */
+	unsigned int scan_last;
+
 	struct regmap *pmsleep;
+
+	/* one scan for the buffer, timestamp needs to be aligned */
+	struct {
+		u16 chans[SAR_MAX_PINS];
+		s64 timestamp __aligned(8);
+	} scan;
 };
 
 static int msc313e_sar_read_raw(struct iio_dev *indio_dev,
@@ -339,9 +355,15 @@ static int msc313e_sar_read_raw(struct iio_dev *indio_dev,
 			   int *val2, long mask)
 {
 	struct msc313e_sar *sar = iio_priv(indio_dev);
+	int ret;
 
 	switch(mask){
 	case IIO_CHAN_INFO_RAW:
+		/* The buffer has the ADC running in free-run mode */
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+
 		// single channel mode
 		regmap_field_force_write(sar->field_singlech, 1);
 		regmap_field_force_write(sar->field_channel, chan->channel);
@@ -356,11 +378,12 @@ static int msc313e_sar_read_raw(struct iio_dev *indio_dev,
 
 		// todo fix this, is this load thing needed
 		// surely there is a done bit somewhere
-		mdelay(1);
+		usleep_range(1000, 1500);
 
 		regmap_field_force_write(sar->field_load, 1);
 
 		regmap_read(sar->regmap, chan->address, val);
+		iio_device_release_direct_mode(indio_dev);
 		if (chan->type == IIO_TEMP) {
 			//formula right out of vendor code
 			*val = (1220 * (400 - *val) + 25000);
@@ -389,26 +412,56 @@ static const struct iio_info msc313e_sar_iio_info = {
 };
 
 #define MSC313E_SAR_CHAN_REG(ch) (0x100 + (ch * 4))
-#define MSC313E_SAR_CHAN(index, _type) \
+#define MSC313E_SAR_CHAN(index, _type, _scan_index) \
 	{ .type = _type, \
 	  .indexed = 1, \
 	  .channel = index, \
 	  .info_mask_separate = BIT(IIO_CHAN_INFO_RAW), \
 	  .info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE), \
 	  .address = MSC313E_SAR_CHAN_REG(index), \
-	  .datasheet_name = "sar#index"\
+	  .datasheet_name = "sar#index", \
+	  .scan_index = _scan_index, \
+	  .scan_type = { \
+		.sign = 'u', \
+		.realbits = 10, \
+		.storagebits = 16, \
+		.endianness = IIO_CPU, \
+	  }, \
 	}
 
-#define MSC313E_SAR_VOLTAGE_CHAN(index)  MSC313E_SAR_CHAN(index, IIO_VOLTAGE)
+#define MSC313E_SAR_VOLTAGE_CHAN(index)  MSC313E_SAR_CHAN(index, IIO_VOLTAGE, index)
 
+/*
+ * Only the pin channels are part of the free-running scan,
+ * the temperature sensor is still one-shot only.
+ */
 static const struct iio_chan_spec msc313e_sar_channels[] = {
 	MSC313E_SAR_VOLTAGE_CHAN(0),
 	MSC313E_SAR_VOLTAGE_CHAN(1),
 	MSC313E_SAR_VOLTAGE_CHAN(2),
 	MSC313E_SAR_VOLTAGE_CHAN(3),
-	MSC313E_SAR_CHAN(6, IIO_TEMP),
+	MSC313E_SAR_CHAN(6, IIO_TEMP, -1),
+	IIO_CHAN_SOFT_TIMESTAMP(SAR_MAX_PINS),
 };
 
+static void msc313e_sar_push_scan(struct iio_dev *indio_dev)
+{
+	struct msc313e_sar *sar = iio_priv(indio_dev);
+	unsigned int val;
+	int ch, i = 0;
+
+	/* latch the latest conversion of every channel */
+	regmap_field_force_write(sar->field_load, 1);
+
+	for_each_set_bit(ch, indio_dev->active_scan_mask, SAR_MAX_PINS) {
+		regmap_read(sar->regmap, MSC313E_SAR_CHAN_REG(ch), &val);
+		sar->scan.chans[i++] = val;
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &sar->scan,
+					   iio_get_time_ns(indio_dev));
+}
+
 static irqreturn_t msc313e_sar_irq(int irq, void *data)
 {
 	struct iio_dev *indio_dev = data;
@@ -420,11 +473,91 @@ static irqreturn_t msc313e_sar_irq(int irq, void *data)
 	regmap_write(sar->regmap, REG_INT_FORCE, 0);
 	regmap_update_bits(sar->regmap, REG_INT_CLR, ~0, ~0);
 
-	printk("sar: int: %x\n", status);
+	/* one push per round of the scan, not one per converted channel */
+	if (iio_buffer_enabled(indio_dev)) {
+		if (status & BIT(sar->scan_last))
+			msc313e_sar_push_scan(indio_dev);
+	} else {
+		dev_dbg(&indio_dev->dev, "int: %x\n", status);
+	}
 
 	return IRQ_HANDLED;
 }
 
+static irqreturn_t msc313e_sar_gpio_wake_irq(int irq, void *data)
+{
+	struct iio_dev *indio_dev = data;
+	struct msc313e_sar *sar = iio_priv(indio_dev);
+	unsigned int status;
+
+	/* The line is shared, only claim it if the SAR raised it */
+	regmap_read(sar->regmap, REG_INT_STATUS, &status);
+	if (!status)
+		return IRQ_NONE;
+
+	regmap_write(sar->regmap, REG_INT_FORCE, 0);
+	regmap_update_bits(sar->regmap, REG_INT_CLR, ~0, ~0);
+
+	pm_wakeup_event(indio_dev->dev.parent, 0);
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * For buffered capture the SAR scans the enabled channels in free-run
+ * mode. The bounds of the last channel in the scan are opened up to the
+ * full range and only its interrupt is unmasked so every round of the
+ * scan raises exactly one interrupt and the handler pushes the samples
+ * of all the channels into the kfifo.
+ */
+static int msc313e_sar_buffer_postenable(struct iio_dev *indio_dev)
+{
+	struct msc313e_sar *sar = iio_priv(indio_dev);
+	unsigned long scan = *indio_dev->active_scan_mask & GENMASK(SAR_MAX_PINS - 1, 0);
+
+	if (!scan)
+		return -EINVAL;
+
+	sar->scan_last = find_last_bit(&scan, SAR_MAX_PINS);
+
+	regmap_write(sar->regmap, REG_CH_UPB(sar->scan_last), SAR_MAX_VAL);
+	regmap_write(sar->regmap, REG_CH_LOB(sar->scan_last), 0);
+
+	regmap_write(sar->regmap, REG_INT_CLR, ~0);
+	regmap_write(sar->regmap, REG_INT_MASK,
+		     ~BIT(sar->scan_last) & GENMASK(SAR_MAX_PINS - 1, 0));
+
+	/* scan mode, the channel field is the last channel in the scan */
+	regmap_field_force_write(sar->field_singlech, 0);
+	regmap_field_force_write(sar->field_channel, sar->scan_last);
+
+	regmap_field_force_write(sar->field_mode, 1);
+	regmap_field_force_write(sar->field_freerun, 1);
+	regmap_field_force_write(sar->field_start, 0);
+	regmap_field_force_write(sar->field_start, 1);
+
+	return 0;
+}
+
+static int msc313e_sar_buffer_predisable(struct iio_dev *indio_dev)
+{
+	struct msc313e_sar *sar = iio_priv(indio_dev);
+
+	regmap_field_force_write(sar->field_freerun, 0);
+	regmap_field_force_write(sar->field_mode, 0);
+	regmap_field_force_write(sar->field_start, 0);
+
+	regmap_write(sar->regmap, REG_INT_CLR, ~0);
+	regmap_write(sar->regmap, REG_INT_MASK, 0);
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops msc313e_sar_buffer_ops = {
+	.postenable = msc313e_sar_buffer_postenable,
+	.predisable = msc313e_sar_buffer_predisable,
+};
+
 static int msc313e_sar_gpio_request(struct gpio_chip *chip, unsigned offset)
 {
 	struct msc313e_sar *sar = gpiochip_get_data(chip);
@@ -691,7 +824,7 @@ static int msc313e_sar_probe(struct platform_device *pdev)
 	if (!sar->wakeirq_gpio)
 		return -EINVAL;
 
-	ret = devm_request_irq(&pdev->dev, sar->wakeirq_gpio, msc313e_sar_irq, IRQF_SHARED,
+	ret = devm_request_irq(&pdev->dev, sar->wakeirq_gpio, msc313e_sar_gpio_wake_irq, IRQF_SHARED,
 			dev_name(&pdev->dev), indio_dev);
 	if (ret)
 		return ret;
@@ -704,6 +837,11 @@ static int msc313e_sar_probe(struct platform_device *pdev)
 	indio_dev->num_channels = ARRAY_SIZE(msc313e_sar_channels);
 	indio_dev->channels = msc313e_sar_channels;
 
+	ret = devm_iio_kfifo_buffer_setup(&pdev->dev, indio_dev,
+					  &msc313e_sar_buffer_ops);
+	if (ret)
+		return ret;
+
 	platform_set_drvdata(pdev, indio_dev);
 
 	ret = devm_iio_device_register(&pdev->dev, indio_dev);
@@ -1,5 +1,9 @@
 // SPDX-License-Identifier: GPL-2.0
 
+#include <linux/bitfield.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/interconnect-provider.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/of_irq.h>
@@ -9,6 +13,7 @@
 #include <linux/clk.h>
 #include <linux/clk-provider.h>
 #include <linux/clkdev.h>
+#include <linux/perf_event.h>
 #include <soc/mstar/miu.h>
 
 #define DRIVER_NAME "msc313-miu"
@@ -74,6 +79,23 @@
  *    15  | 14   | 12 | 11 - 8 | 7 - 0
  * twr[4] | tccd |  txp   | trfc
  *
+ * 0x034 - bandwidth monitor client select?
+ *        14
+ * client id[6]
+ *
+ * 0x038 - bandwidth monitor result
+ * The vendor code reads this as a fraction of the total DDR
+ * bandwidth out of 1024 for the client and metric selected below.
+ *
+ * 0x054 - bandwidth monitor control
+ *   13 - 8       | 7 - 4              | 0
+ * client id[5:0] | metric             | en
+ *                | 0x3 - efficiency?  |
+ *                | 0x4 - average bw?  |
+ *                | 0x5 - peak bw?     |
+ * The vendor code writes 0 and then the client/metric before setting
+ * en, presumably that resets the monitor.
+ *
  * The vendor suspend code writes 0xFFFF to all of these
  * but the first where it writes 0xFFFE instead
  * Presumably this is to stop requests happening while it
@@ -84,6 +106,20 @@
  * 0x10c - group 2 request mask
  * 0x14c - group 3 request mask
  *
+ * Each group is 0x40 long starting at 0x080, the rest of the
+ * group registers that look like the MSB2521 ones:
+ *
+ * 0x00 - group ctrl
+ *          0
+ * member burst limit en?
+ *
+ * 0x04 - member burst limit
+ *   7 - 0
+ * requests a client gets before the arbiter moves on?
+ *
+ * 0x10 - 0x1c client priority
+ * 4 bits per client, higher gets more slots?
+ *
  * 0x180 - protection 0 start
  * 0x184 - protection 0 end
  * 0x188 - protection 1 start
@@ -114,6 +150,49 @@
  * 0x04c - group 5 request mask?
  */
 
+#define MIU_DIG_BW_CLIENT_SEL		0x034
+#define MIU_DIG_BW_CLIENT_SEL_HI	BIT(14)
+#define MIU_DIG_BW_RESULT		0x038
+#define MIU_DIG_BW_CTRL			0x054
+#define MIU_DIG_BW_CTRL_EN		BIT(0)
+#define MIU_DIG_BW_CTRL_METRIC		GENMASK(7, 4)
+#define MIU_DIG_BW_CTRL_CLIENT		GENMASK(13, 8)
+
+#define MIU_DIG_GROUP(_g)		(0x080 + ((_g) * 0x40))
+#define MIU_DIG_GROUP_CTRL		0x00
+#define MIU_DIG_GROUP_CTRL_LIMIT_EN	BIT(0)
+#define MIU_DIG_GROUP_LIMIT		0x04
+#define MIU_DIG_GROUP_LIMIT_MEMBER	GENMASK(7, 0)
+#define MIU_DIG_GROUP_PRIO(_c)		(0x10 + (((_c) / 4) * 4))
+#define MIU_DIG_GROUP_PRIO_SHIFT(_c)	(((_c) % 4) * 4)
+#define MIU_DIG_GROUP_PRIO_MASK(_c)	(0xf << MIU_DIG_GROUP_PRIO_SHIFT(_c))
+
+#define MIU_GROUPS			4
+#define MIU_GROUP_CLIENTS		16
+#define MIU_CLIENTS			(MIU_GROUPS * MIU_GROUP_CLIENTS)
+
+/* Interconnect node indexes, the clients come first and are group * 16 + client */
+#define MIU_ICC_DDR			MIU_CLIENTS
+#define MIU_ICC_NODES			(MIU_CLIENTS + 1)
+
+/*
+ * Node ids are global to the interconnect core and icc_node_create()
+ * hands back an existing node on a clash, so the MIU's nodes live at
+ * this reserved base rather than at 0. The DT cells are still the
+ * indexes above.
+ */
+#define MIU_ICC_ID_BASE			0x3130000
+#define MIU_ICC_ID(_i)			(MIU_ICC_ID_BASE + (_i))
+
+/* Burst limit applied to a group once one of its clients asks for bandwidth */
+#define MIU_QOS_BURST_LIMIT		4
+
+struct msc313_miu_group_regs {
+	unsigned int ctrl;
+	unsigned int limit;
+	unsigned int prio[MIU_GROUP_CLIENTS / 4];
+};
+
 struct msc313_miu {
 	struct device *dev;
 	struct regmap *analog;
@@ -124,9 +203,23 @@ struct msc313_miu {
 	/* ddr pll bits */
 	char const *ddrpllparents[1];
 	struct clk_hw clk_hw;
+
+	/* bandwidth monitor pmu bits */
+	struct pmu pmu;
+	struct hrtimer pmu_timer;
+	struct perf_event *pmu_event;
+	unsigned int pmu_cpu;
+
+	/* qos bits */
+	int buswidth;
+	struct icc_provider provider;
+	struct icc_onecell_data *icc_data;
+	struct msc313_miu_group_regs boot_groups[MIU_GROUPS];
 };
 
 #define to_miu(_hw) container_of(_hw, struct msc313_miu, clk_hw)
+#define to_miu_pmu(_pmu) container_of(_pmu, struct msc313_miu, pmu)
+#define to_miu_provider(_provider) container_of(_provider, struct msc313_miu, provider)
 
 static const struct of_device_id msc313_miu_dt_ids[] = {
 	{ .compatible = "mstar,msc313-miu" },
@@ -148,6 +241,8 @@ static const struct regmap_config msc313_miu_digital_regmap_config = {
 	.reg_bits = 16,
 	.val_bits = 16,
 	.reg_stride = 4,
+	/* The bandwidth monitor PMU is driven from hrtimer and perf irq-off context */
+	.fast_io = true,
 };
 
 static const char *types[] = {"SDR", "DDR", "DDR2", "DDR3"};
@@ -289,6 +384,447 @@ static int msc313_miu_ddrpll_probe(struct platform_device *pdev,
 	return of_clk_add_provider(dev->of_node, of_clk_src_simple_get, clk);
 }
 
+#ifdef CONFIG_PERF_EVENTS
+/*
+ * There is a single bandwidth monitor that watches one client for one
+ * metric at a time and only gives a current reading, not a running
+ * count. So only one event can be active and the count is made up of
+ * readings taken every MIU_PMU_POLL_NS, i.e. the sum of the client's
+ * share of the DDR bandwidth in 1/1024ths over each poll period.
+ */
+#define MIU_PMU_POLL_NS			(10 * NSEC_PER_MSEC)
+#define MIU_PMU_CONFIG_CLIENT		GENMASK(6, 0)
+#define MIU_PMU_CONFIG_METRIC		GENMASK(9, 8)
+
+static const unsigned int msc313_miu_pmu_metrics[] = {
+	0x4,	/* bw_avg */
+	0x5,	/* bw_peak */
+	0x3,	/* efficiency */
+};
+
+PMU_FORMAT_ATTR(client, "config:0-6");
+PMU_FORMAT_ATTR(metric, "config:8-9");
+
+static struct attribute *msc313_miu_pmu_format_attrs[] = {
+	&format_attr_client.attr,
+	&format_attr_metric.attr,
+	NULL,
+};
+
+static const struct attribute_group msc313_miu_pmu_format_group = {
+	.name = "format",
+	.attrs = msc313_miu_pmu_format_attrs,
+};
+
+PMU_EVENT_ATTR_STRING(bw_avg, msc313_miu_pmu_bw_avg, "metric=0,client=?");
+PMU_EVENT_ATTR_STRING(bw_peak, msc313_miu_pmu_bw_peak, "metric=1,client=?");
+PMU_EVENT_ATTR_STRING(efficiency, msc313_miu_pmu_efficiency, "metric=2,client=?");
+
+static struct attribute *msc313_miu_pmu_event_attrs[] = {
+	&msc313_miu_pmu_bw_avg.attr.attr,
+	&msc313_miu_pmu_bw_peak.attr.attr,
+	&msc313_miu_pmu_efficiency.attr.attr,
+	NULL,
+};
+
+static const struct attribute_group msc313_miu_pmu_event_group = {
+	.name = "events",
+	.attrs = msc313_miu_pmu_event_attrs,
+};
+
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct msc313_miu *miu = to_miu_pmu(dev_get_drvdata(dev));
+
+	return cpumap_print_to_pagebuf(true, buf, cpumask_of(miu->pmu_cpu));
+}
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *msc313_miu_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group msc313_miu_pmu_cpumask_group = {
+	.attrs = msc313_miu_pmu_cpumask_attrs,
+};
+
+static const struct attribute_group *msc313_miu_pmu_attr_groups[] = {
+	&msc313_miu_pmu_format_group,
+	&msc313_miu_pmu_event_group,
+	&msc313_miu_pmu_cpumask_group,
+	NULL,
+};
+
+static void msc313_miu_pmu_sample(struct msc313_miu *miu, struct perf_event *event)
+{
+	unsigned int val;
+
+	if (!regmap_read(miu->digital, MIU_DIG_BW_RESULT, &val))
+		local64_add(val, &event->count);
+}
+
+static enum hrtimer_restart msc313_miu_pmu_poll(struct hrtimer *timer)
+{
+	struct msc313_miu *miu = container_of(timer, struct msc313_miu, pmu_timer);
+
+	if (!miu->pmu_event)
+		return HRTIMER_NORESTART;
+
+	msc313_miu_pmu_sample(miu, miu->pmu_event);
+	hrtimer_forward_now(timer, ns_to_ktime(MIU_PMU_POLL_NS));
+
+	return HRTIMER_RESTART;
+}
+
+static int msc313_miu_pmu_event_init(struct perf_event *event)
+{
+	struct msc313_miu *miu = to_miu_pmu(event->pmu);
+	struct perf_event *sibling;
+	unsigned int metric;
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	if (is_sampling_event(event) || event->attach_state & PERF_ATTACH_TASK)
+		return -EOPNOTSUPP;
+
+	if (event->cpu < 0)
+		return -EINVAL;
+
+	if (event->attr.config & ~(MIU_PMU_CONFIG_CLIENT | MIU_PMU_CONFIG_METRIC))
+		return -EINVAL;
+
+	metric = FIELD_GET(MIU_PMU_CONFIG_METRIC, event->attr.config);
+	if (metric >= ARRAY_SIZE(msc313_miu_pmu_metrics))
+		return -EINVAL;
+
+	/* There's only one monitor so there can't be two of us in a group */
+	if (event->group_leader != event && event->group_leader->pmu == event->pmu)
+		return -EINVAL;
+	for_each_sibling_event(sibling, event->group_leader) {
+		if (sibling != event && sibling->pmu == event->pmu)
+			return -EINVAL;
+	}
+
+	event->cpu = miu->pmu_cpu;
+
+	return 0;
+}
+
+static void msc313_miu_pmu_start(struct perf_event *event, int flags)
+{
+	struct msc313_miu *miu = to_miu_pmu(event->pmu);
+	unsigned int client = FIELD_GET(MIU_PMU_CONFIG_CLIENT, event->attr.config);
+	unsigned int metric = FIELD_GET(MIU_PMU_CONFIG_METRIC, event->attr.config);
+	unsigned int ctrl;
+
+	ctrl = FIELD_PREP(MIU_DIG_BW_CTRL_CLIENT, client & 0x3f) |
+	       FIELD_PREP(MIU_DIG_BW_CTRL_METRIC, msc313_miu_pmu_metrics[metric]);
+
+	regmap_update_bits(miu->digital, MIU_DIG_BW_CLIENT_SEL, MIU_DIG_BW_CLIENT_SEL_HI,
+			   client & BIT(6) ? MIU_DIG_BW_CLIENT_SEL_HI : 0);
+	regmap_write(miu->digital, MIU_DIG_BW_CTRL, 0);
+	regmap_write(miu->digital, MIU_DIG_BW_CTRL, ctrl);
+	regmap_write(miu->digital, MIU_DIG_BW_CTRL, ctrl | MIU_DIG_BW_CTRL_EN);
+
+	event->hw.state = 0;
+	hrtimer_start(&miu->pmu_timer, ns_to_ktime(MIU_PMU_POLL_NS), HRTIMER_MODE_REL_PINNED);
+}
+
+static void msc313_miu_pmu_stop(struct perf_event *event, int flags)
+{
+	struct msc313_miu *miu = to_miu_pmu(event->pmu);
+
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+
+	hrtimer_cancel(&miu->pmu_timer);
+	regmap_write(miu->digital, MIU_DIG_BW_CTRL, 0);
+
+	event->hw.state |= PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+static int msc313_miu_pmu_add(struct perf_event *event, int flags)
+{
+	struct msc313_miu *miu = to_miu_pmu(event->pmu);
+
+	if (miu->pmu_event)
+		return -EBUSY;
+
+	miu->pmu_event = event;
+	event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+
+	if (flags & PERF_EF_START)
+		msc313_miu_pmu_start(event, flags);
+
+	return 0;
+}
+
+static void msc313_miu_pmu_del(struct perf_event *event, int flags)
+{
+	struct msc313_miu *miu = to_miu_pmu(event->pmu);
+
+	msc313_miu_pmu_stop(event, PERF_EF_UPDATE);
+	miu->pmu_event = NULL;
+}
+
+static void msc313_miu_pmu_read(struct perf_event *event)
+{
+	/* The count is kept up to date by msc313_miu_pmu_poll() */
+}
+
+static void msc313_miu_pmu_unregister(void *data)
+{
+	struct msc313_miu *miu = data;
+
+	perf_pmu_unregister(&miu->pmu);
+}
+
+static int msc313_miu_pmu_probe(struct msc313_miu *miu)
+{
+	int ret;
+
+	/* The MIU doesn't belong to any CPU so just count from the boot CPU */
+	miu->pmu_cpu = 0;
+
+	hrtimer_init(&miu->pmu_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	miu->pmu_timer.function = msc313_miu_pmu_poll;
+
+	miu->pmu = (struct pmu) {
+		.module = THIS_MODULE,
+		.task_ctx_nr = perf_invalid_context,
+		.capabilities = PERF_PMU_CAP_NO_EXCLUDE,
+		.attr_groups = msc313_miu_pmu_attr_groups,
+		.event_init = msc313_miu_pmu_event_init,
+		.add = msc313_miu_pmu_add,
+		.del = msc313_miu_pmu_del,
+		.start = msc313_miu_pmu_start,
+		.stop = msc313_miu_pmu_stop,
+		.read = msc313_miu_pmu_read,
+	};
+
+	ret = perf_pmu_register(&miu->pmu, "msc313_miu", -1);
+	if (ret)
+		return ret;
+
+	return devm_add_action_or_reset(miu->dev, msc313_miu_pmu_unregister, miu);
+}
+#else
+static int msc313_miu_pmu_probe(struct msc313_miu *miu)
+{
+	return 0;
+}
+#endif
+
+#if IS_REACHABLE(CONFIG_INTERCONNECT)
+/*
+ * QoS
+ *
+ * Consumers ask for bandwidth with interconnects = <&miu client &miu 64>
+ * where client is group * 16 + the client's position in the group's
+ * request mask. Clients with a request get an arbitration priority
+ * that scales with their share of the DDR bandwidth, everything else
+ * keeps what the boot loader left. Once a client in a group has asked
+ * for bandwidth the group's member burst limit is turned on so a
+ * bursting neighbour like the GE or FCIE has to let it in.
+ */
+static u32 msc313_miu_qos_ddr_kbps(struct msc313_miu *miu)
+{
+	/* Double data rate, roughly */
+	return (clk_hw_get_rate(&miu->clk_hw) / 1000) * 2 * (miu->buswidth / 8);
+}
+
+static unsigned int msc313_miu_qos_prio(struct msc313_miu *miu, struct icc_node *node,
+					unsigned int boot)
+{
+	u32 ddr_kbps = msc313_miu_qos_ddr_kbps(miu);
+	u64 share;
+
+	if (!node->avg_bw && !node->peak_bw)
+		return boot;
+
+	if (!ddr_kbps)
+		return 0xf;
+
+	share = div_u64((u64) max(node->avg_bw, node->peak_bw) * 0xf, ddr_kbps);
+
+	return clamp_t(u64, share, 1, 0xf);
+}
+
+static int msc313_miu_qos_apply_group(struct msc313_miu *miu, unsigned int group)
+{
+	struct msc313_miu_group_regs *boot = &miu->boot_groups[group];
+	unsigned int base = MIU_DIG_GROUP(group);
+	bool limit = false;
+	unsigned int i, prio, val;
+	int ret;
+
+	for (i = 0; i < MIU_GROUP_CLIENTS; i++) {
+		struct icc_node *node = miu->icc_data->nodes[(group * MIU_GROUP_CLIENTS) + i];
+
+		prio = (boot->prio[i / 4] & MIU_DIG_GROUP_PRIO_MASK(i)) >>
+			MIU_DIG_GROUP_PRIO_SHIFT(i);
+		prio = msc313_miu_qos_prio(miu, node, prio);
+
+		ret = regmap_update_bits(miu->digital, base + MIU_DIG_GROUP_PRIO(i),
+					 MIU_DIG_GROUP_PRIO_MASK(i),
+					 prio << MIU_DIG_GROUP_PRIO_SHIFT(i));
+		if (ret)
+			return ret;
+
+		if (node->avg_bw || node->peak_bw)
+			limit = true;
+	}
+
+	if (limit) {
+		val = (boot->limit & ~MIU_DIG_GROUP_LIMIT_MEMBER) |
+		      FIELD_PREP(MIU_DIG_GROUP_LIMIT_MEMBER, MIU_QOS_BURST_LIMIT);
+		ret = regmap_write(miu->digital, base + MIU_DIG_GROUP_LIMIT, val);
+		if (ret)
+			return ret;
+
+		return regmap_write(miu->digital, base + MIU_DIG_GROUP_CTRL,
+				    boot->ctrl | MIU_DIG_GROUP_CTRL_LIMIT_EN);
+	}
+
+	ret = regmap_write(miu->digital, base + MIU_DIG_GROUP_CTRL, boot->ctrl);
+	if (ret)
+		return ret;
+
+	return regmap_write(miu->digital, base + MIU_DIG_GROUP_LIMIT, boot->limit);
+}
+
+static int msc313_miu_qos_set(struct icc_node *src, struct icc_node *dst)
+{
+	struct msc313_miu *miu = to_miu_provider(src->provider);
+
+	unsigned int client = src->id - MIU_ICC_ID_BASE;
+
+	if (client >= MIU_CLIENTS)
+		return 0;
+
+	return msc313_miu_qos_apply_group(miu, client / MIU_GROUP_CLIENTS);
+}
+
+static int msc313_miu_qos_show(struct seq_file *s, void *data)
+{
+	struct msc313_miu *miu = s->private;
+	unsigned int group, i, val;
+
+	seq_printf(s, "ddr bandwidth: %u kBps\n", msc313_miu_qos_ddr_kbps(miu));
+
+	for (group = 0; group < MIU_GROUPS; group++) {
+		unsigned int base = MIU_DIG_GROUP(group);
+
+		regmap_read(miu->digital, base + MIU_DIG_GROUP_CTRL, &val);
+		seq_printf(s, "group %u: burst limit %s", group,
+			   val & MIU_DIG_GROUP_CTRL_LIMIT_EN ? "on" : "off");
+		regmap_read(miu->digital, base + MIU_DIG_GROUP_LIMIT, &val);
+		seq_printf(s, " (%lu)\n", FIELD_GET(MIU_DIG_GROUP_LIMIT_MEMBER, val));
+
+		for (i = 0; i < MIU_GROUP_CLIENTS; i++) {
+			struct icc_node *node = miu->icc_data->nodes[(group * MIU_GROUP_CLIENTS) + i];
+
+			regmap_read(miu->digital, base + MIU_DIG_GROUP_PRIO(i), &val);
+			seq_printf(s, "  client %2u: prio %2u avg %u kBps peak %u kBps\n",
+				   node->id - MIU_ICC_ID_BASE,
+				   (val & MIU_DIG_GROUP_PRIO_MASK(i)) >> MIU_DIG_GROUP_PRIO_SHIFT(i),
+				   node->avg_bw, node->peak_bw);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(msc313_miu_qos);
+
+static void msc313_miu_qos_remove(void *data)
+{
+	struct msc313_miu *miu = data;
+
+	icc_provider_deregister(&miu->provider);
+	icc_nodes_remove(&miu->provider);
+}
+
+static void msc313_miu_debugfs_remove(void *data)
+{
+	debugfs_remove_recursive(data);
+}
+
+static int msc313_miu_qos_probe(struct msc313_miu *miu)
+{
+	struct icc_provider *provider = &miu->provider;
+	struct icc_node *node;
+	struct dentry *dir;
+	unsigned int group, i;
+	int ret;
+
+	for (group = 0; group < MIU_GROUPS; group++) {
+		struct msc313_miu_group_regs *boot = &miu->boot_groups[group];
+		unsigned int base = MIU_DIG_GROUP(group);
+
+		regmap_read(miu->digital, base + MIU_DIG_GROUP_CTRL, &boot->ctrl);
+		regmap_read(miu->digital, base + MIU_DIG_GROUP_LIMIT, &boot->limit);
+		for (i = 0; i < ARRAY_SIZE(boot->prio); i++)
+			regmap_read(miu->digital, base + MIU_DIG_GROUP_PRIO(i * 4), &boot->prio[i]);
+	}
+
+	miu->icc_data = devm_kzalloc(miu->dev, struct_size(miu->icc_data, nodes, MIU_ICC_NODES),
+				     GFP_KERNEL);
+	if (!miu->icc_data)
+		return -ENOMEM;
+	miu->icc_data->num_nodes = MIU_ICC_NODES;
+
+	provider->dev = miu->dev;
+	provider->set = msc313_miu_qos_set;
+	provider->aggregate = icc_std_aggregate;
+	provider->xlate = of_icc_xlate_onecell;
+	provider->data = miu->icc_data;
+	icc_provider_init(provider);
+
+	for (i = 0; i < MIU_ICC_NODES; i++) {
+		node = icc_node_create(MIU_ICC_ID(i));
+		if (IS_ERR(node)) {
+			ret = PTR_ERR(node);
+			goto err_nodes;
+		}
+
+		node->name = devm_kasprintf(miu->dev, GFP_KERNEL,
+					    i == MIU_ICC_DDR ? "ddr" : "client%u", i);
+		icc_node_add(node, provider);
+		miu->icc_data->nodes[i] = node;
+
+		if (i != MIU_ICC_DDR) {
+			ret = icc_link_create(node, MIU_ICC_ID(MIU_ICC_DDR));
+			if (ret)
+				goto err_nodes;
+		}
+	}
+
+	ret = icc_provider_register(provider);
+	if (ret)
+		goto err_nodes;
+
+	ret = devm_add_action_or_reset(miu->dev, msc313_miu_qos_remove, miu);
+	if (ret)
+		return ret;
+
+	dir = debugfs_create_dir(dev_name(miu->dev), NULL);
+	debugfs_create_file("qos", 0444, dir, miu, &msc313_miu_qos_fops);
+
+	return devm_add_action_or_reset(miu->dev, msc313_miu_debugfs_remove, dir);
+
+err_nodes:
+	icc_nodes_remove(provider);
+	return ret;
+}
+#else
+static int msc313_miu_qos_probe(struct msc313_miu *miu)
+{
+	return 0;
+}
+#endif
+
 static irqreturn_t msc313_miu_irq(int irq, void *data)
 {
 	struct msc313_miu *miu = data;
@@ -309,7 +845,7 @@ static int msc313_miu_probe(struct platform_device *pdev)
 
 	int banks, cols, buswidth;
 	int trcd, trp, tras, trrd, trtp, trc;
-	int irq;
+	int irq, ret;
 
 	u32 dtval;
 
@@ -376,6 +912,7 @@ static int msc313_miu_probe(struct platform_device *pdev)
 	banks = 2  << ((config1 & REG_CONFIG1_BANKS) >> REG_CONFIG1_BANKS_SHIFT);
 	cols = 8 + ((config1 & REG_CONFIG1_COLS) >> REG_CONFIG1_COLS_SHIFT);
 	buswidth = (((config1 & REG_CONFIG1_BUSWIDTH) >> REG_CONFIG1_BUSWIDTH_SHIFT) + 1) * 16;
+	miu->buswidth = buswidth;
 
 
 	dev_info(dev, "Memory type is %s, %d banks and %d columns, %d bit bus", types[config1 & REG_CONFIG1_TYPE],
@@ -406,7 +943,20 @@ static int msc313_miu_probe(struct platform_device *pdev)
 	//	msc313_miu_write_trp(miu, dtval);
 	//}
 
-	return msc313_miu_ddrpll_probe(pdev, miu);
+	ret = msc313_miu_pmu_probe(miu);
+	if (ret)
+		dev_warn(dev, "Failed to register bandwidth monitor pmu: %d\n", ret);
+
+	ret = msc313_miu_ddrpll_probe(pdev, miu);
+	if (ret)
+		return ret;
+
+	/* The QoS weights are worked out from the DDR pll rate so this comes last */
+	ret = msc313_miu_qos_probe(miu);
+	if (ret)
+		dev_warn(dev, "Failed to register interconnect provider: %d\n", ret);
+
+	return 0;
 }
 
 static int msc313_miu_remove(struct platform_device *pdev)
@@ -4,6 +4,10 @@
  */
 
 #include <linux/bitfield.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/platform_device.h>
@@ -17,6 +21,10 @@
 #include <linux/mmc/sdio.h>
 #include <linux/mmc/slot-gpio.h>
 #include <linux/regulator/consumer.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "mstar-fcie.h"
 
@@ -107,8 +115,53 @@
 
 #define FCIE_CMD_TIMEOUT_NS (NSEC_PER_SEC/10)
 
+/*
+ * The controller walks the ADMA table until it finds a descriptor with the
+ * end bit set, so the table can be as long as we like. Each descriptor can
+ * cover up to 0xffff blocks.
+ */
+#define FCIE_ADMA_DESCS		256
+#define FCIE_ADMA_TABLE_SZ	(FCIE_ADMA_DESCS * sizeof(struct msc313_sdio_adma_desc))
+#define FCIE_MAX_SEG_SZ		SZ_64K
+#define FCIE_MAX_BLK_COUNT	4096
+
+/* request size histogram, power of two buckets from 512 bytes to 2MiB */
+#define FCIE_STATS_SZ_BUCKETS	13
+
+enum mstar_fcie_job_type {
+	FCIE_JOB_CMD,
+	FCIE_JOB_BUSY,
+	FCIE_JOB_DATA,
+	FCIE_JOB_TYPES,
+};
+
+struct mstar_fcie_job_stats {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+/* data->host_cookie */
+#define FCIE_COOKIE_UNMAPPED	0
+#define FCIE_COOKIE_PRE_MAPPED	BIT(0)	/* mapped by .pre_req */
+#define FCIE_COOKIE_MAPPED	BIT(1)	/* mapped by .request */
+#define FCIE_COOKIE_TABLE1	BIT(2)	/* ADMA table is descs[1] */
+
+/*
+ * A request is run as a chain of jobs, one per phase. Each phase is
+ * started from the completion of the previous one.
+ */
+enum mstar_fcie_phase {
+	FCIE_PHASE_IDLE,
+	FCIE_PHASE_SBC,
+	FCIE_PHASE_CMD,
+	FCIE_PHASE_DATA,
+	FCIE_PHASE_STOP,
+};
+
 struct msc313_fcie {
 	struct device *dev;
+	struct mmc_host *mmc;
 	struct regmap *regmap;
 	struct clk *clk;
 	bool use_polling;
@@ -144,13 +197,39 @@ struct msc313_fcie {
 	/* misc */
 	struct regmap_field *func_ctrl;
 
-	wait_queue_head_t wait;
+	/* protects the request state below */
+	struct mutex lock;
+	struct mmc_request *mrq;
+	enum mstar_fcie_phase phase;
+	int rspsz;
+
+	/* current job */
+	bool job_running;
+	bool want_cmd;
+	bool want_data;
+	bool want_busy;
+	unsigned int timeout_ns;
+	unsigned long deadline;
+	ktime_t job_start_time;
+	struct delayed_work timeout_work;
+
+	/* set from the interrupt handler */
 	bool error;
 	bool cmd_done;
 	bool busy_done;
 	bool data_done;
 
-	struct msc313_sdio_adma_desc descs[64];
+	/*
+	 * ADMA tables, coherent so they don't need mapping per request.
+	 * One table for the running request, one for the next.
+	 */
+	struct msc313_sdio_adma_desc *descs[2];
+	dma_addr_t descs_dma[2];
+	unsigned int next_table;
+
+	/* statistics, protected by lock */
+	u64 req_sizes[FCIE_STATS_SZ_BUCKETS];
+	struct mstar_fcie_job_stats job_stats[FCIE_JOB_TYPES];
 };
 
 static const struct of_device_id msc313_fcie_dt_ids[] = {
@@ -218,15 +297,10 @@ static irqreturn_t msc313_fcie_irq(int irq, void *data)
 {
 	struct msc313_fcie *fcie = data;
 
-	msc313_fcie_parse_and_clear_int_flags(fcie);
-
-	if (fcie->cmd_done ||
-	    fcie->data_done ||
-	    fcie->busy_done ||
-	    fcie->error)
-		wake_up(&fcie->wait);
+	if (!msc313_fcie_parse_and_clear_int_flags(fcie))
+		return IRQ_NONE;
 
-	return IRQ_HANDLED;
+	return IRQ_WAKE_THREAD;
 }
 
 static void mstar_fcie_writecmd(struct msc313_fcie *fcie, u8 cmd, u32 arg)
@@ -302,74 +376,103 @@ static bool mstar_fcie_parse_and_check_flags(struct msc313_fcie *fcie, unsigned
 	return ret;
 }
 
-static int mstar_fcie_start_transfer_and_wait(struct msc313_fcie *fcie,
-		bool cmd, bool data, bool busy, unsigned int timeout_ns,
-		unsigned int* status)
+static bool mstar_fcie_job_complete(struct msc313_fcie *fcie)
 {
-	unsigned long timeout_jiffies = nsecs_to_jiffies(timeout_ns);
-	unsigned int job_start, intflags, ctrl, blkcnt,
-			blksz, cmdrspsz, poll_timeout;
+	if (fcie->error)
+		return true;
+
+	return (!fcie->want_cmd || fcie->cmd_done) &&
+	       (!fcie->want_data || fcie->data_done) &&
+	       (!fcie->want_busy || fcie->busy_done);
+}
+
+/*
+ * Clear the interrupt flags and make sure they actually read back as clear
+ * before the next job is started. Otherwise polling can see the flags
+ * from the previous job and the controller starts corrupting memory.
+ */
+static void mstar_fcie_clear_int_flags(struct msc313_fcie *fcie)
+{
+	unsigned int intflags;
+
+	regmap_write(fcie->regmap, REG_INT, ~0);
+	if (regmap_read_poll_timeout_atomic(fcie->regmap, REG_INT, intflags,
+			!(intflags & (INT_CMD_END | INT_DATA_END | INT_BUSY_END | INT_ERR)),
+			1, 1000))
+		dev_warn(fcie->dev, "stale interrupt flags: %04x\n", intflags);
+}
+
+/*
+ * Kick off a job. Completion is signalled through the threaded interrupt
+ * handler or, if there is no interrupt, by mstar_fcie_poll_job().
+ */
+static void mstar_fcie_start_job(struct msc313_fcie *fcie,
+		bool cmd, bool data, bool busy, unsigned int timeout_ns)
+{
+	unsigned long timeout_jiffies = max(nsecs_to_jiffies(timeout_ns), 1UL);
+	unsigned int job_start;
 
 	/* clear the flags and start the transfer */
 	regmap_field_force_write(fcie->status, ~0);
+	mstar_fcie_clear_int_flags(fcie);
 	fcie->error = false;
 	fcie->cmd_done = false;
 	fcie->data_done = false;
 	fcie->busy_done = false;
+	fcie->want_cmd = cmd;
+	fcie->want_data = data;
+	fcie->want_busy = busy;
+	fcie->timeout_ns = timeout_ns;
 
 	/* enable interrupts */
-	regmap_write(fcie->regmap, REG_INTMASK, data ? INT_DATA_END : 0 |
-						cmd ? INT_CMD_END : 0   |
-						busy ? INT_BUSY_END : 0 |
+	regmap_write(fcie->regmap, REG_INTMASK, (data ? INT_DATA_END : 0) |
+						(cmd ? INT_CMD_END : 0)   |
+						(busy ? INT_BUSY_END : 0) |
 						INT_ERR);
 
 	regmap_field_read(fcie->job_start, &job_start);
 	if (job_start)
 		dev_warn(fcie->dev, "job start was 1 before triggering!\n");
 
-	//printk("%s:%d, t:%d\n", __func__, __LINE__, timeout_ns);
-
+	fcie->job_running = true;
+	fcie->job_start_time = ktime_get();
 	regmap_field_force_write(fcie->job_start, 1);
 
-	if (fcie->use_polling) {
-		/*
-		 * we have to wait some time before polling the flags otherwise
-		 * the controller starts corrupting memory, probably because the
-		 * flags we have are old
-		 */
-		mdelay(100);
-
-		poll_timeout = regmap_read_poll_timeout(fcie->regmap, REG_INT, intflags,
-				mstar_fcie_parse_and_check_flags(fcie,intflags,cmd,data,busy), HZ/10, HZ * 10);
-		regmap_write(fcie->regmap, REG_INT, ~0);
-		if (poll_timeout) {
-			dev_warn(fcie->dev, "timeout while polling\n");
-			return 1;
-		}
+	if (!fcie->use_polling) {
+		fcie->deadline = jiffies + timeout_jiffies;
+		mod_delayed_work(system_wq, &fcie->timeout_work, timeout_jiffies);
 	}
-	else {
-		/* wait until the interrupt fires and sets cmd_done */
-		if (cmd && !fcie->cmd_done) {
-			if(wait_event_timeout(fcie->wait, fcie->cmd_done || fcie->error,
-					timeout_jiffies) == 0)
-				goto irq_timeout;
-		}
+}
 
-		/* wait until the interrupt fires and sets data_done */
-		if (data && !fcie->data_done) {
-			if(wait_event_timeout(fcie->wait, fcie->data_done || fcie->error,
-					timeout_jiffies) == 0)
-				goto irq_timeout;
-		}
+/* Wait for the current job to finish when there is no interrupt */
+static int mstar_fcie_poll_job(struct msc313_fcie *fcie)
+{
+	/* Same deadline as the interrupt path, at least a jiffy */
+	unsigned long timeout_us = max_t(unsigned long, fcie->timeout_ns / NSEC_PER_USEC,
+					 jiffies_to_usecs(1));
+	unsigned long sleep_us = clamp(timeout_us / 100, 10UL, 1000UL);
+	unsigned int intflags;
+	int poll_timeout;
+
+	poll_timeout = regmap_read_poll_timeout(fcie->regmap, REG_INT, intflags,
+			mstar_fcie_parse_and_check_flags(fcie, intflags, fcie->want_cmd,
+							 fcie->want_data, fcie->want_busy),
+			sleep_us, timeout_us);
+	regmap_write(fcie->regmap, REG_INT, ~0);
+	fcie->job_running = false;
+	if (poll_timeout) {
+		dev_warn(fcie->dev, "timeout while polling\n");
+		regmap_write(fcie->regmap, REG_INTMASK, 0);
+		return -ETIMEDOUT;
+	}
 
-		/* wait until the interrupt fires and sets busy_done */
-		if (busy && !fcie->busy_done) {
-			if(wait_event_timeout(fcie->wait, fcie->busy_done || fcie->error,
-					timeout_jiffies) == 0)
-				goto irq_timeout;
-		}
+	return 0;
+}
 
-	}
+/* Collect the status of a job that finished, successfully or not */
+static int mstar_fcie_job_result(struct msc313_fcie *fcie, unsigned int *status)
+{
+	unsigned int ctrl, blkcnt, blksz, cmdrspsz;
 
 	regmap_field_read(fcie->status, status);
 
@@ -384,7 +487,8 @@ static int mstar_fcie_start_transfer_and_wait(struct msc313_fcie *fcie,
 				"blksz: %04x, blkcnt: %04x, cmdrspsz: %04x\n",
 				*status, ctrl, blksz, blkcnt, cmdrspsz);
 		dev_info(fcie->dev, "err during job; cmd %d (%d), data %d (%d), busy %d (%d)\n",
-				fcie->cmd_done, cmd, fcie->data_done, data, fcie->busy_done, busy);
+				fcie->cmd_done, fcie->want_cmd, fcie->data_done, fcie->want_data,
+				fcie->busy_done, fcie->want_busy);
 	}
 
 	/* disable interrupts */
@@ -397,28 +501,8 @@ static int mstar_fcie_start_transfer_and_wait(struct msc313_fcie *fcie,
 	 * a false CRC error etc. Only timeouts are handled here.
 	 */
 	if (fcie->error && *status == 0)
-		return 1;
-
-	return 0;
-
-irq_timeout:
-	/* disable interrupts */
-	regmap_write(fcie->regmap, REG_INTMASK, 0);
-//printk("%s:%d\n", __func__, __LINE__);
-	intflags = msc313_fcie_parse_and_clear_int_flags(fcie);
-	regmap_field_read(fcie->status, status);
-	regmap_read(fcie->regmap, REG_SD_CTL, &ctrl);
-	regmap_read(fcie->regmap, REG_BLOCK_COUNT, &blkcnt);
-	regmap_read(fcie->regmap, REG_BLOCK_SIZE, &blksz);
-	regmap_read(fcie->regmap, REG_CMDRSP_SIZE, &cmdrspsz);
-
-	dev_warn(fcie->dev, "timeout waiting for interrupt, timeout: %d, int: %04x, "
-			"status: %04x, ctrl: %04x, blksz: %04x, blkcnt: %04x, cmdrspsz: %04x\n",
-		timeout_ns, intflags, *status, ctrl, blksz, blkcnt, cmdrspsz);
-	if ((cmd && !fcie->cmd_done) || (data && !fcie->data_done) || (busy && !fcie->busy_done)) {
-		dev_err(fcie->dev, "timedout and no status flags were set");
 		return -ETIMEDOUT;
-	}
+
 	return 0;
 }
 
@@ -511,30 +595,25 @@ static int mstar_fcie_request_capturecmdresult(struct msc313_fcie *fcie,
 	return 0;
 }
 
-/* Prepare a command, transmit it and set cmd->error if there was an issue */
-static int mstar_fcie_request_prepcmd_and_tx(struct msc313_fcie *fcie, struct mmc_command *cmd)
+/* Prepare a command and start transmitting it */
+static void mstar_fcie_request_start_cmd(struct msc313_fcie *fcie,
+		struct mmc_command *cmd, enum mstar_fcie_phase phase)
 {
 	unsigned int timeout = cmd->busy_timeout ? cmd->busy_timeout * 1000000 : FCIE_CMD_TIMEOUT_NS;
-	int rspsz = mstar_fcie_request_setupcmd(fcie, cmd);
-	unsigned int status;
-
-	cmd->error = mstar_fcie_start_transfer_and_wait(fcie, true, false,
-			cmd->flags & MMC_RSP_BUSY, timeout, &status);
-	if (cmd->error)
-		return cmd->error;
-
-	mstar_fcie_request_capturecmdresult(fcie, cmd, status, rspsz);
 
-	return cmd->error;
+	fcie->phase = phase;
+	fcie->rspsz = mstar_fcie_request_setupcmd(fcie, cmd);
+	mstar_fcie_start_job(fcie, true, false, cmd->flags & MMC_RSP_BUSY, timeout);
 }
 
-static void msc313_fcie_build_adma(struct msc313_fcie *fcie, struct scatterlist *data_sg,
-		int count, int blksz, u32 *tfxlen)
+static void msc313_fcie_build_adma(struct msc313_fcie *fcie,
+		struct msc313_sdio_adma_desc *descs, struct scatterlist *data_sg,
+		int count, int blksz)
 {
 	struct scatterlist *sg;
 	int i;
 	for_each_sg(data_sg, sg, count, i) {
-		struct msc313_sdio_adma_desc *desc = &fcie->descs[i];
+		struct msc313_sdio_adma_desc *desc = &descs[i];
 		desc->dmaaddr = sg_dma_address(sg);
 		desc->dmalen = sg_dma_len(sg);
 		desc->ctrl = FIELD_PREP(ADMA_DESC_CTRL_END, i + 1 == count) |
@@ -542,98 +621,104 @@ static void msc313_fcie_build_adma(struct msc313_fcie *fcie, struct scatterlist
 			     FIELD_PREP(ADMA_DESC_JOB_CNT, desc->dmalen / blksz);
 		dev_dbg(fcie->dev, "desc %d:%d: ctrl: 0x%08x, dmaaddr: 0x%08x, dmalen: 0x%08x",
 				i, count, desc->ctrl, desc->dmaaddr, desc->dmalen);
-		*tfxlen += desc->dmalen;
 	}
 }
-static void mstar_fcie_request(struct mmc_host *mmc, struct mmc_request *mrq)
+
+/*
+ * Map the data and, if there is more than one segment, build the ADMA
+ * table for it. This is called from .pre_req while the previous request
+ * is still running so the tables are double buffered.
+ */
+static int mstar_fcie_prepare_data(struct msc313_fcie *fcie,
+		struct mmc_data *data, int cookie)
+{
+	unsigned int table = fcie->next_table;
+
+	if (data->host_cookie & FCIE_COOKIE_PRE_MAPPED)
+		return 0;
+
+	data->sg_count = dma_map_sg(fcie->dev, data->sg, data->sg_len,
+				    mmc_get_dma_dir(data));
+	if (data->sg_count == 0)
+		return -EINVAL;
+
+	if (data->sg_count > 1) {
+		msc313_fcie_build_adma(fcie, fcie->descs[table], data->sg,
+				data->sg_count, data->blksz);
+		fcie->next_table = !table;
+		if (table)
+			cookie |= FCIE_COOKIE_TABLE1;
+	}
+
+	data->host_cookie = cookie;
+
+	return 0;
+}
+
+static void mstar_fcie_unprepare_data(struct msc313_fcie *fcie, struct mmc_data *data)
+{
+	if (data->host_cookie == FCIE_COOKIE_UNMAPPED)
+		return;
+
+	dma_unmap_sg(fcie->dev, data->sg, data->sg_len, mmc_get_dma_dir(data));
+
+	data->host_cookie = FCIE_COOKIE_UNMAPPED;
+}
+
+static void mstar_fcie_pre_req(struct mmc_host *mmc, struct mmc_request *mrq)
 {
 	struct msc313_fcie *fcie = mmc_priv(mmc);
-	int rspsz, i, count, dir_data, blks, ret;
-	struct mmc_command *cmd = mrq->cmd;
-	struct mmc_command *sbc = mrq->sbc;
 	struct mmc_data *data = mrq->data;
-	bool dataread, sbcdone, useadma, busydet;
-	unsigned int status, cardbusy;
-	u32 dmaaddr, dmalen, tfrlen;
 
-	/* If there is just a command, send it and return */
-	if (data == NULL) {
-		if(mstar_fcie_request_prepcmd_and_tx(fcie, cmd)) {
-			dev_err(fcie->dev, "failed to send command; cmd: %d arg: 0x%08x\n",
-					cmd->opcode, cmd->arg);
-			goto tfr_err;
-		}
-		mmc_request_done(mmc, mrq);
+	if (!data)
 		return;
-	}
 
-	/* There is data, but read or write is not set.. */
-	if (!(data->flags & (MMC_DATA_READ | MMC_DATA_WRITE))) {
-		dev_err(fcie->dev, "don't know what to do with this data, flags 0x%08x\n", data->flags);
-		goto tfr_err;
-	}
+	data->host_cookie = FCIE_COOKIE_UNMAPPED;
+	if (data->flags & (MMC_DATA_READ | MMC_DATA_WRITE))
+		mstar_fcie_prepare_data(fcie, data, FCIE_COOKIE_PRE_MAPPED);
+}
 
-	/* If we have a set-block-count command send it now */
-	if (sbc) {
-		if(mstar_fcie_request_prepcmd_and_tx(fcie, sbc)) {
-			dev_err(fcie->dev, "failed to sbc; cmd: 0x%02x arg: 0x%08x\n",
-					sbc->opcode, sbc->arg);
-			goto tfr_err;
-		}
-		sbcdone = true;
-	}
+static void mstar_fcie_post_req(struct mmc_host *mmc, struct mmc_request *mrq, int err)
+{
+	struct msc313_fcie *fcie = mmc_priv(mmc);
+
+	if (mrq->data)
+		mstar_fcie_unprepare_data(fcie, mrq->data);
+}
+
+/* Program the DMA for the data of the current request and start it */
+static void mstar_fcie_request_start_data(struct msc313_fcie *fcie)
+{
+	struct mmc_request *mrq = fcie->mrq;
+	struct mmc_command *cmd = mrq->cmd;
+	struct mmc_data *data = mrq->data;
+	bool dataread = data->flags & MMC_DATA_READ;
+	unsigned int table = data->host_cookie & FCIE_COOKIE_TABLE1 ? 1 : 0;
+	u32 dmaaddr, dmalen;
+	bool busydet;
+	int blks;
 
 	/*
 	 * If there is data to read the cmd goes with the first block
-	 * of data coming in if there is no data or we're writing
-	 * run the command on it's own.
-	 *
-	 * It's possible we don't actually need to do this for writes
-	 * but I haven't got it to work any other way.
+	 * of data coming in, so setup the command here.
 	 */
-	dataread = data->flags & MMC_DATA_READ;
-	if (!dataread) {
-		if(mstar_fcie_request_prepcmd_and_tx(fcie, cmd)) {
-			dev_err(fcie->dev, "failed to send command; cmd: 0x%02x arg: 0x%08x\n",
-					cmd->opcode, cmd->arg);
-			goto tfr_err;
-		}
-	}
-
-	/* If we're doing a read setup the command for the first block */
 	if (dataread)
-		rspsz = mstar_fcie_request_setupcmd(fcie, mrq->cmd);
+		fcie->rspsz = mstar_fcie_request_setupcmd(fcie, cmd);
 	else
 		regmap_write(fcie->regmap, REG_SD_CTL, 0);
 
-	dir_data = dataread ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
-	count = dma_map_sg(fcie->dev, data->sg, data->sg_len, dir_data);
-	if (count == 0)
-		goto drv_err;
-
 	/* if there is more than one sg use ADMA */
-	useadma = count > 1;
-	if (useadma) {
-		//printk("using ADMA\n");
-		msc313_fcie_build_adma(fcie, data->sg, count, data->blksz, &tfrlen);
-		dmaaddr = dma_map_single(fcie->dev, &fcie->descs, sizeof(fcie->descs), DMA_TO_DEVICE);
-		ret = dma_mapping_error(fcie->dev, dmaaddr);
-		if (ret) {
-			printk("dma map fail\n");
-			data->error = ret;
-			goto tfr_err;
-		}
+	if (data->sg_count > 1) {
+		dmaaddr = fcie->descs_dma[table];
 		dmalen = 0x10;
 		blks = 1;
 		regmap_field_write(fcie->adma_en, 1);
 	}
 	/* otherwise use direct dma */
 	else {
-		//printk("Using single dma\n");
 		dmaaddr = sg_dma_address(data->sg);
 		dmalen = sg_dma_len(data->sg);
 		blks = dmalen / data->blksz;
-		tfrlen = dmalen;
 	}
 
 	/* Setup this transfer */
@@ -652,73 +737,293 @@ static void mstar_fcie_request(struct mmc_host *mmc, struct mmc_request *mrq)
 #endif
 
 	busydet = dataread && (cmd->flags & MMC_RSP_BUSY);
-	ret = mstar_fcie_start_transfer_and_wait(fcie, dataread,
-			true, busydet, data->timeout_ns, &status);
-	if (ret) {
-		data->error = ret;
-		dev_err(fcie->dev, "data %s error; cmd: 0x%02x arg: 0x%08x, blk_sz: %d, blk_cnt %d .. %d:%d\n",
-				dataread ? "read" : "write", cmd->opcode, cmd->arg, data->blksz, blks, i, count);
-		goto tfr_err;
+	fcie->phase = FCIE_PHASE_DATA;
+	mstar_fcie_start_job(fcie, dataread, true, busydet, data->timeout_ns);
+}
+
+/* Capture the result of a command job. Sets cmd->error */
+static int mstar_fcie_request_cmd_result(struct msc313_fcie *fcie,
+		struct mmc_command *cmd, int err, unsigned int status)
+{
+	if (err) {
+		cmd->error = err;
+		return err;
 	}
-	/*
-	 * the first block will have also triggered sending the cmd
-	 * if this was a read so capture the rsp etc for that here
-	 * and clear the cmd flags for the next block
-	 */
-	if (dataread) {
-		ret = mstar_fcie_request_capturecmdresult(fcie, mrq->cmd, status, rspsz);
-		if (ret && ret != -EBUSY)
+
+	mstar_fcie_request_capturecmdresult(fcie, cmd, status, fcie->rspsz);
+
+	return cmd->error;
+}
+
+/* Tear down the current request, returns it so it can be completed */
+static struct mmc_request *mstar_fcie_request_finish(struct msc313_fcie *fcie)
+{
+	struct mmc_request *mrq = fcie->mrq;
+
+	if (mrq->data && (mrq->data->host_cookie & FCIE_COOKIE_MAPPED))
+		mstar_fcie_unprepare_data(fcie, mrq->data);
+
+	fcie->phase = FCIE_PHASE_IDLE;
+	fcie->mrq = NULL;
+
+	return mrq;
+}
+
+static void mstar_fcie_account_job(struct msc313_fcie *fcie)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), fcie->job_start_time));
+	struct mstar_fcie_job_stats *stats;
+
+	if (fcie->want_data)
+		stats = &fcie->job_stats[FCIE_JOB_DATA];
+	else if (fcie->want_busy)
+		stats = &fcie->job_stats[FCIE_JOB_BUSY];
+	else
+		stats = &fcie->job_stats[FCIE_JOB_CMD];
+
+	stats->count++;
+	stats->total_ns += ns;
+	stats->max_ns = max(stats->max_ns, ns);
+}
+
+static void mstar_fcie_account_request(struct msc313_fcie *fcie, struct mmc_data *data)
+{
+	unsigned int bucket = ilog2(max(data->blocks * data->blksz / 512, 1U));
+
+	fcie->req_sizes[min_t(unsigned int, bucket, FCIE_STATS_SZ_BUCKETS - 1)]++;
+}
+
+/*
+ * The job for the current phase has finished, work out what happens next.
+ * Returns the request if it is now done.
+ */
+static struct mmc_request *mstar_fcie_request_next(struct msc313_fcie *fcie, int err)
+{
+	struct mmc_request *mrq = fcie->mrq;
+	struct mmc_command *cmd = mrq->cmd;
+	struct mmc_data *data = mrq->data;
+	unsigned int status = 0, cardbusy;
+	int ret;
+
+	mstar_fcie_account_job(fcie);
+
+	if (!err)
+		err = mstar_fcie_job_result(fcie, &status);
+
+	switch (fcie->phase) {
+	case FCIE_PHASE_SBC:
+		if (mstar_fcie_request_cmd_result(fcie, mrq->sbc, err, status)) {
+			dev_err(fcie->dev, "failed to sbc; cmd: 0x%02x arg: 0x%08x\n",
+					mrq->sbc->opcode, mrq->sbc->arg);
 			goto tfr_err;
-	}
+		}
+
+		/*
+		 * Reads send the command with the first block of data,
+		 * writes send it on it's own first.
+		 *
+		 * It's possible we don't actually need to do this for writes
+		 * but I haven't got it to work any other way.
+		 */
+		if (data->flags & MMC_DATA_READ)
+			mstar_fcie_request_start_data(fcie);
+		else
+			mstar_fcie_request_start_cmd(fcie, cmd, FCIE_PHASE_CMD);
+		return NULL;
+	case FCIE_PHASE_CMD:
+		if (mstar_fcie_request_cmd_result(fcie, cmd, err, status)) {
+			dev_err(fcie->dev, "failed to send command; cmd: 0x%02x arg: 0x%08x\n",
+					cmd->opcode, cmd->arg);
+			goto tfr_err;
+		}
+
+		if (data) {
+			mstar_fcie_request_start_data(fcie);
+			return NULL;
+		}
+		break;
+	case FCIE_PHASE_DATA:
+		if (err) {
+			data->error = err;
+			dev_err(fcie->dev, "data %s error; cmd: 0x%02x arg: 0x%08x, blk_sz: %d, blk_cnt %d, sg: %d\n",
+					data->flags & MMC_DATA_READ ? "read" : "write",
+					cmd->opcode, cmd->arg, data->blksz, data->blocks,
+					data->sg_count);
+			goto tfr_err;
+		}
+
+		/*
+		 * the first block will have also triggered sending the cmd
+		 * if this was a read so capture the rsp etc for that here
+		 */
+		if (data->flags & MMC_DATA_READ) {
+			ret = mstar_fcie_request_capturecmdresult(fcie, cmd, status, fcie->rspsz);
+			if (ret && ret != -EBUSY)
+				goto tfr_err;
+		}
 
-	{
-		unsigned int cardbusy;
 		regmap_field_read_poll_timeout(fcie->d0, cardbusy, cardbusy, 0, 1000);
+
+		/* check for errors */
+		if (status & SD_STS_DATRDCERR) {
+			dev_err(fcie->dev, "data read CRC error\n");
+			data->error = -EILSEQ;
+		}
+
+		if (status & SD_STS_DATWRCERR) {
+			dev_err(fcie->dev, "data write CRC error\n");
+			data->error = -EILSEQ;
+		}
+
+		if (!data->error)
+			data->bytes_xfered += data->blksz * data->blocks;
+
+		/*
+		 * If sbc wasn't sent then send the stop command here.
+		 * The card doesn't respond to this if sbc was sent.
+		 *
+		 * We probably also need to do this if there was an error during the transfer.
+		 */
+		if (!mrq->sbc && mrq->stop) {
+			mstar_fcie_request_start_cmd(fcie, mrq->stop, FCIE_PHASE_STOP);
+			return NULL;
+		}
+		break;
+	case FCIE_PHASE_STOP:
+		if (mstar_fcie_request_cmd_result(fcie, mrq->stop, err, status))
+			dev_err(fcie->dev, "data stop command timeout; cmd: 0x%02x arg: 0x%08x, flags: 0x%08x\n",
+				mrq->stop->opcode, mrq->stop->arg, mrq->stop->flags);
+		break;
+	default:
+		break;
 	}
 
-	/* check for errors */
-	if (status & SD_STS_DATRDCERR) {
-		dev_err(fcie->dev, "data read CRC error\n");
-		data->error = -EILSEQ;
+	return mstar_fcie_request_finish(fcie);
+
+tfr_err:
+	if (mrq->stop) {
+		mstar_fcie_request_start_cmd(fcie, mrq->stop, FCIE_PHASE_STOP);
+		return NULL;
 	}
 
-	if (status & SD_STS_DATWRCERR) {
-		dev_err(fcie->dev, "data write CRC error\n");
-		data->error = -EILSEQ;
+	return mstar_fcie_request_finish(fcie);
+}
+
+/* Start the first job for a new request */
+static struct mmc_request *mstar_fcie_request_start(struct msc313_fcie *fcie,
+		struct mmc_request *mrq)
+{
+	struct mmc_data *data = mrq->data;
+
+	fcie->mrq = mrq;
 
+	/* If there is just a command, send it */
+	if (data == NULL) {
+		mstar_fcie_request_start_cmd(fcie, mrq->cmd, FCIE_PHASE_CMD);
+		return NULL;
 	}
 
-	data->bytes_xfered += tfrlen;
+	/* There is data, but read or write is not set.. */
+	if (!(data->flags & (MMC_DATA_READ | MMC_DATA_WRITE))) {
+		dev_err(fcie->dev, "don't know what to do with this data, flags 0x%08x\n", data->flags);
+		data->error = -EINVAL;
+		return mstar_fcie_request_finish(fcie);
+	}
 
-	/*
-	 * If sbc wasn't sent then send the stop command here.
-	 * The card doesn't respond to this if sbc was sent.
-	 *
-	 * We probably also need to do this if there was an error during the transfer.
-	 */
-	if (!sbcdone && data->stop) {
-		struct mmc_command *stop = data->stop;
-		int ret = mstar_fcie_request_prepcmd_and_tx(fcie, stop);
+	mstar_fcie_account_request(fcie, data);
 
-		if (ret)
-			dev_err(fcie->dev, "data stop command timeout; cmd: 0x%02x arg: 0x%08x, flags: 0x%08x\n",
-				stop->opcode, stop->arg, stop->flags);
+	/* Map the data here if .pre_req didn't already do it */
+	if (mstar_fcie_prepare_data(fcie, data, FCIE_COOKIE_MAPPED)) {
+		mrq->cmd->error = -EINVAL;
+		return mstar_fcie_request_finish(fcie);
 	}
 
-	if (useadma)
-		dma_unmap_single(fcie->dev, dmaaddr, sizeof(fcie->descs), DMA_TO_DEVICE);
-	dma_unmap_sg(fcie->dev, data->sg, data->sg_len, dir_data);
+	/* If we have a set-block-count command send it now */
+	if (mrq->sbc)
+		mstar_fcie_request_start_cmd(fcie, mrq->sbc, FCIE_PHASE_SBC);
+	else if (data->flags & MMC_DATA_READ)
+		mstar_fcie_request_start_data(fcie);
+	else
+		mstar_fcie_request_start_cmd(fcie, mrq->cmd, FCIE_PHASE_CMD);
 
-done:
-	mmc_request_done(mmc, mrq);
-	return;
+	return NULL;
+}
 
-drv_err:
-	mrq->cmd->error = -EINVAL;
-tfr_err:
-	if (mrq->stop)
-		mstar_fcie_request_prepcmd_and_tx(fcie, mrq->stop);
-	mmc_request_done(mmc, mrq);
+static void mstar_fcie_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msc313_fcie *fcie = mmc_priv(mmc);
+	struct mmc_request *done;
+
+	mutex_lock(&fcie->lock);
+	done = mstar_fcie_request_start(fcie, mrq);
+
+	/* Without an interrupt every job of the request is waited for here */
+	while (!done && fcie->use_polling)
+		done = mstar_fcie_request_next(fcie, mstar_fcie_poll_job(fcie));
+	mutex_unlock(&fcie->lock);
+
+	if (done)
+		mmc_request_done(mmc, done);
+}
+
+static irqreturn_t msc313_fcie_irq_thread(int irq, void *data)
+{
+	struct msc313_fcie *fcie = data;
+	struct mmc_request *done = NULL;
+
+	mutex_lock(&fcie->lock);
+	if (fcie->mrq && fcie->job_running && mstar_fcie_job_complete(fcie)) {
+		fcie->job_running = false;
+		cancel_delayed_work(&fcie->timeout_work);
+		done = mstar_fcie_request_next(fcie, 0);
+	}
+	mutex_unlock(&fcie->lock);
+
+	if (done)
+		mmc_request_done(fcie->mmc, done);
+
+	return IRQ_HANDLED;
+}
+
+static void mstar_fcie_timeout_work(struct work_struct *work)
+{
+	struct msc313_fcie *fcie = container_of(to_delayed_work(work),
+						struct msc313_fcie, timeout_work);
+	unsigned int intflags, status, ctrl, blkcnt, blksz, cmdrspsz;
+	struct mmc_request *done = NULL;
+	int err = 0;
+
+	mutex_lock(&fcie->lock);
+
+	/* The job finished or a new one was started in the meantime */
+	if (!fcie->mrq || !fcie->job_running || time_before(jiffies, fcie->deadline))
+		goto out;
+
+	fcie->job_running = false;
+
+	/* disable interrupts */
+	regmap_write(fcie->regmap, REG_INTMASK, 0);
+	intflags = msc313_fcie_parse_and_clear_int_flags(fcie);
+	regmap_field_read(fcie->status, &status);
+	regmap_read(fcie->regmap, REG_SD_CTL, &ctrl);
+	regmap_read(fcie->regmap, REG_BLOCK_COUNT, &blkcnt);
+	regmap_read(fcie->regmap, REG_BLOCK_SIZE, &blksz);
+	regmap_read(fcie->regmap, REG_CMDRSP_SIZE, &cmdrspsz);
+
+	dev_warn(fcie->dev, "timeout waiting for interrupt, timeout: %d, int: %04x, "
+			"status: %04x, ctrl: %04x, blksz: %04x, blkcnt: %04x, cmdrspsz: %04x\n",
+		fcie->timeout_ns, intflags, status, ctrl, blksz, blkcnt, cmdrspsz);
+	if (!mstar_fcie_job_complete(fcie)) {
+		dev_err(fcie->dev, "timedout and no status flags were set");
+		err = -ETIMEDOUT;
+	}
+
+	done = mstar_fcie_request_next(fcie, err);
+out:
+	mutex_unlock(&fcie->lock);
+
+	if (done)
+		mmc_request_done(fcie->mmc, done);
 }
 
 static void mstar_fcie_card_power(struct mmc_host *mmc,
@@ -819,7 +1124,58 @@ static void mstar_fcie_hw_reset(struct mmc_host *host)
 			100000);
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int mstar_fcie_stats_show(struct seq_file *s, void *data)
+{
+	static const char * const job_names[FCIE_JOB_TYPES] = {
+		[FCIE_JOB_CMD] = "cmd",
+		[FCIE_JOB_BUSY] = "busy",
+		[FCIE_JOB_DATA] = "data",
+	};
+	struct mmc_host *mmc = s->private;
+	struct msc313_fcie *fcie = mmc_priv(mmc);
+	struct mstar_fcie_job_stats *stats;
+	int i;
+
+	seq_printf(s, "max_segs: %u, max_seg_size: %u, max_blk_count: %u, max_req_size: %u\n",
+			mmc->max_segs, mmc->max_seg_size, mmc->max_blk_count, mmc->max_req_size);
+
+	mutex_lock(&fcie->lock);
+
+	seq_puts(s, "\nrequest size histogram:\n");
+	for (i = 0; i < FCIE_STATS_SZ_BUCKETS; i++)
+		seq_printf(s, "%8u: %llu\n", 512 << i, fcie->req_sizes[i]);
+
+	seq_puts(s, "\njob latency (ns):\n");
+	for (i = 0; i < FCIE_JOB_TYPES; i++) {
+		stats = &fcie->job_stats[i];
+		seq_printf(s, "%-4s count: %llu, avg: %llu, max: %llu\n", job_names[i],
+				stats->count,
+				stats->count ? div64_u64(stats->total_ns, stats->count) : 0,
+				stats->max_ns);
+	}
+
+	mutex_unlock(&fcie->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mstar_fcie_stats);
+
+static void mstar_fcie_debugfs(struct mmc_host *mmc)
+{
+	if (mmc->debugfs_root)
+		debugfs_create_file("fcie_stats", 0444, mmc->debugfs_root,
+				mmc, &mstar_fcie_stats_fops);
+}
+#else
+static void mstar_fcie_debugfs(struct mmc_host *mmc)
+{
+}
+#endif
+
 static struct mmc_host_ops mstar_fcie_ops = {
+	.pre_req	= mstar_fcie_pre_req,
+	.post_req	= mstar_fcie_post_req,
 	.request	= mstar_fcie_request,
 	.set_ios	= mstar_fcie_set_ios,
 	.get_cd		= mmc_gpio_get_cd,
@@ -832,7 +1188,7 @@ static int msc313_fcie_probe(struct platform_device *pdev)
 	struct msc313_fcie *fcie;
 	struct mmc_host *mmc;
 	__iomem void *base;
-	int irq, ret = 0;
+	int i, irq, ret = 0;
 
 	mmc = mmc_alloc_host(sizeof(*fcie), &pdev->dev);
 	if (!mmc) {
@@ -847,7 +1203,9 @@ static int msc313_fcie_probe(struct platform_device *pdev)
 	mmc->ops = &mstar_fcie_ops;
 
 	fcie = mmc_priv(mmc);
-	init_waitqueue_head(&fcie->wait);
+	fcie->mmc = mmc;
+	mutex_init(&fcie->lock);
+	INIT_DELAYED_WORK(&fcie->timeout_work, mstar_fcie_timeout_work);
 
 	ret = mmc_of_parse(mmc);
 	if(ret)
@@ -900,8 +1258,8 @@ static int msc313_fcie_probe(struct platform_device *pdev)
 		fcie->use_polling = true;
 	}
 	else {
-		ret = devm_request_irq(&pdev->dev, irq, msc313_fcie_irq, IRQF_SHARED,
-			dev_name(&pdev->dev), fcie);
+		ret = devm_request_threaded_irq(&pdev->dev, irq, msc313_fcie_irq,
+			msc313_fcie_irq_thread, IRQF_SHARED, dev_name(&pdev->dev), fcie);
 		if (ret)
 			return ret;
 	}
@@ -925,21 +1283,35 @@ static int msc313_fcie_probe(struct platform_device *pdev)
 	if (mmc->f_max < 0)
 		return ((int) mmc->f_max);
 
-	mmc->max_blk_count = 128;
+	for (i = 0; i < ARRAY_SIZE(fcie->descs); i++) {
+		fcie->descs[i] = dmam_alloc_coherent(&pdev->dev, FCIE_ADMA_TABLE_SZ,
+				&fcie->descs_dma[i], GFP_KERNEL);
+		if (!fcie->descs[i])
+			return -ENOMEM;
+	}
+
+	mmc->max_blk_count = FCIE_MAX_BLK_COUNT;
 	mmc->max_blk_size = 512;
-	mmc->max_segs = ARRAY_SIZE(fcie->descs);
+	mmc->max_segs = FCIE_ADMA_DESCS;
+	mmc->max_seg_size = FCIE_MAX_SEG_SZ;
 	mmc->max_req_size = mmc->max_blk_count * mmc->max_blk_size;
 
 	ret = mmc_add_host(mmc);
+	if (ret)
+		return ret;
 
-	return ret;
+	mstar_fcie_debugfs(mmc);
+
+	return 0;
 }
 
 static int msc313_fcie_remove(struct platform_device *pdev)
 {
 	struct mmc_host	*mmc = platform_get_drvdata(pdev);
+	struct msc313_fcie *fcie = mmc_priv(mmc);
 
 	mmc_remove_host(mmc);
+	cancel_delayed_work_sync(&fcie->timeout_work);
 	mmc_free_host(mmc);
 
 	return 0;
@@ -1166,6 +1166,24 @@ static const struct gem_statistic queue_statistics[] = {
 
 #define QUEUE_STATS_LEN ARRAY_SIZE(queue_statistics)
 
+/* MStar EMAC page_pool RX statistics, each should be unsigned long type */
+struct at91ether_rx_stats {
+	union {
+		unsigned long first;
+		unsigned long rx_recycled;
+	};
+	unsigned long rx_copied;
+	unsigned long rx_alloc_failed;
+};
+
+static const struct gem_statistic at91ether_rx_statistics[] = {
+		QUEUE_STAT_TITLE("rx_recycled"),
+		QUEUE_STAT_TITLE("rx_copied"),
+		QUEUE_STAT_TITLE("rx_alloc_failed"),
+};
+
+#define AT91ETHER_RX_STATS_LEN ARRAY_SIZE(at91ether_rx_statistics)
+
 struct macb;
 struct macb_queue;
 
@@ -1253,6 +1271,8 @@ struct macb_queue {
 	struct macb_dma_desc	*rx_ring;
 	struct sk_buff		**rx_skbuff;
 	void			*rx_buffers;
+	struct page_pool	*page_pool;
+	struct page		**rx_page;
 	struct napi_struct	napi_rx;
 	struct queue_stats stats;
 };
@@ -1318,8 +1338,14 @@ struct macb {
 	struct macb_tx_skb	*rm9200_txq;
 	unsigned int		rm9200_tx_tail;
 	unsigned int		rm9200_tx_len;
+	/* MStar: free hardware slots as of the last TSR read */
+	unsigned int		rm9200_tx_free;
 	unsigned int		max_tx_length;
 
+	/* MStar EMAC page_pool RX: frames up to rx_copybreak are copied */
+	unsigned int		rx_copybreak;
+	struct at91ether_rx_stats rx_pp_stats;
+
 	u64			ethtool_stats[GEM_STATS_LEN + QUEUE_STATS_LEN * MACB_MAX_QUEUES];
 
 	unsigned int		rx_frm_len_mask;
@@ -38,6 +38,7 @@
 #include <linux/ptp_classify.h>
 #include <linux/reset.h>
 #include <linux/firmware/xlnx-zynqmp.h>
+#include <net/page_pool/helpers.h>
 #ifdef CONFIG_ARCH_MSTARV7
 #include <soc/mstar/riuxiu.h>
 #endif
@@ -4265,20 +4266,118 @@ static const struct macb_usrio_config macb_default_usrio = {
 #define AT91ETHER_MAX_RBUFF_SZ	0x600
 /* max number of receive buffers */
 #define AT91ETHER_MAX_RX_DESCR	9
+/* number of page_pool backed receive buffers in NAPI mode */
+#define AT91ETHER_NAPI_RX_DESCR	64
+#define AT91ETHER_PP_HEADROOM	NET_SKB_PAD
+/* The low bits of the descriptor address are flags so the buffers stay
+ * word aligned and NCFGR.RBOF moves the frame NET_IP_ALIGN bytes in.
+ */
+#define AT91ETHER_RX_OFFSET	(AT91ETHER_PP_HEADROOM + NET_IP_ALIGN)
+/* Frames up to this size are copied and the page is handed straight
+ * back to the hardware.
+ */
+#define AT91ETHER_RX_COPYBREAK	256
+#define AT91ETHER_RX_INT_FLAGS	MACB_BIT(RCOMP)
 
 static struct sifive_fu540_macb_mgmt *mgmt;
 
+/* MStar EMACs receive into page_pool pages from NAPI context */
+static bool at91ether_rx_uses_napi(struct macb *lp)
+{
+	return lp->caps & MACB_CAPS_MSTAR_TXQ;
+}
+
+static unsigned int at91ether_rx_ring_len(struct macb *lp)
+{
+	return at91ether_rx_uses_napi(lp) ? AT91ETHER_NAPI_RX_DESCR :
+					    AT91ETHER_MAX_RX_DESCR;
+}
+
+static void at91ether_free_rx_pages(struct macb *lp)
+{
+	struct macb_queue *q = &lp->queues[0];
+	int i;
+
+	if (q->rx_page) {
+		for (i = 0; i < AT91ETHER_NAPI_RX_DESCR; i++) {
+			if (q->rx_page[i])
+				page_pool_put_full_page(q->page_pool,
+							q->rx_page[i], false);
+		}
+		kfree(q->rx_page);
+		q->rx_page = NULL;
+	}
+
+	if (q->page_pool) {
+		page_pool_destroy(q->page_pool);
+		q->page_pool = NULL;
+	}
+}
+
+static int at91ether_alloc_rx_pages(struct macb *lp)
+{
+	struct macb_queue *q = &lp->queues[0];
+	struct page_pool_params pp_params = { 0 };
+	int i, ret;
+
+	pp_params.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV;
+	pp_params.pool_size = AT91ETHER_NAPI_RX_DESCR;
+	pp_params.nid = dev_to_node(&lp->pdev->dev);
+	pp_params.dev = &lp->pdev->dev;
+	pp_params.napi = &q->napi_rx;
+	pp_params.dma_dir = DMA_FROM_DEVICE;
+	pp_params.offset = AT91ETHER_PP_HEADROOM;
+	pp_params.max_len = AT91ETHER_MAX_RBUFF_SZ;
+
+	q->page_pool = page_pool_create(&pp_params);
+	if (IS_ERR(q->page_pool)) {
+		ret = PTR_ERR(q->page_pool);
+		q->page_pool = NULL;
+		return ret;
+	}
+
+	q->rx_page = kcalloc(AT91ETHER_NAPI_RX_DESCR, sizeof(*q->rx_page),
+			     GFP_KERNEL);
+	if (!q->rx_page)
+		goto err;
+
+	for (i = 0; i < AT91ETHER_NAPI_RX_DESCR; i++) {
+		q->rx_page[i] = page_pool_dev_alloc_pages(q->page_pool);
+		if (!q->rx_page[i])
+			goto err;
+	}
+
+	return 0;
+
+err:
+	at91ether_free_rx_pages(lp);
+	return -ENOMEM;
+}
+
 static int at91ether_alloc_coherent(struct macb *lp)
 {
 	struct macb_queue *q = &lp->queues[0];
 
 	q->rx_ring = dma_alloc_coherent(&lp->pdev->dev,
-					 (AT91ETHER_MAX_RX_DESCR *
+					 (at91ether_rx_ring_len(lp) *
 					  macb_dma_desc_get_size(lp)),
 					 &q->rx_ring_dma, GFP_KERNEL);
 	if (!q->rx_ring)
 		return -ENOMEM;
 
+	if (at91ether_rx_uses_napi(lp)) {
+		if (at91ether_alloc_rx_pages(lp)) {
+			dma_free_coherent(&lp->pdev->dev,
+					  AT91ETHER_NAPI_RX_DESCR *
+					  macb_dma_desc_get_size(lp),
+					  q->rx_ring, q->rx_ring_dma);
+			q->rx_ring = NULL;
+			return -ENOMEM;
+		}
+
+		return 0;
+	}
+
 	q->rx_buffers = dma_alloc_coherent(&lp->pdev->dev,
 					    AT91ETHER_MAX_RX_DESCR *
 					    AT91ETHER_MAX_RBUFF_SZ,
@@ -4301,12 +4400,14 @@ static void at91ether_free_coherent(struct macb *lp)
 
 	if (q->rx_ring) {
 		dma_free_coherent(&lp->pdev->dev,
-				  AT91ETHER_MAX_RX_DESCR *
+				  at91ether_rx_ring_len(lp) *
 				  macb_dma_desc_get_size(lp),
 				  q->rx_ring, q->rx_ring_dma);
 		q->rx_ring = NULL;
 	}
 
+	at91ether_free_rx_pages(lp);
+
 	if (q->rx_buffers) {
 		dma_free_coherent(&lp->pdev->dev,
 				  AT91ETHER_MAX_RX_DESCR *
@@ -4330,8 +4431,11 @@ static int at91ether_start(struct macb *lp)
 		return ret;
 
 	addr = q->rx_buffers_dma;
-	for (i = 0; i < AT91ETHER_MAX_RX_DESCR; i++) {
+	for (i = 0; i < at91ether_rx_ring_len(lp); i++) {
 		desc = macb_rx_desc(q, i);
+		if (q->rx_page)
+			addr = page_pool_get_dma_addr(q->rx_page[i]) +
+			       AT91ETHER_PP_HEADROOM;
 		macb_set_addr(lp, desc, addr);
 		desc->ctrl = 0;
 		addr += AT91ETHER_MAX_RBUFF_SZ;
@@ -4343,6 +4447,9 @@ static int at91ether_start(struct macb *lp)
 	/* Reset buffer index */
 	q->rx_tail = 0;
 
+	/* Make the first transmit re-read the hardware queue state */
+	lp->rm9200_tx_free = 0;
+
 	/* Program address of descriptor list in Rx Buffer Queue register */
 	macb_writel(lp, RBQP, q->rx_ring_dma);
 
@@ -4350,6 +4457,9 @@ static int at91ether_start(struct macb *lp)
 	ctl = macb_readl(lp, NCR);
 	macb_writel(lp, NCR, ctl | MACB_BIT(RE) | MACB_BIT(TE));
 
+	if (at91ether_rx_uses_napi(lp))
+		napi_enable(&q->napi_rx);
+
 	/* Enable MAC interrupts */
 	macb_writel(lp, IER, MACB_BIT(RCOMP)	|
 			     MACB_BIT(RXUBR)	|
@@ -4381,6 +4491,10 @@ static void at91ether_stop(struct macb *lp)
 	ctl = macb_readl(lp, NCR);
 	macb_writel(lp, NCR, ctl & ~(MACB_BIT(TE) | MACB_BIT(RE)));
 
+	/* The page_pool can only be torn down with its NAPI instance off */
+	if (at91ether_rx_uses_napi(lp))
+		napi_disable(&lp->queues[0].napi_rx);
+
 	/* Free resources. */
 	at91ether_free_coherent(lp);
 }
@@ -4410,6 +4524,7 @@ static int at91ether_open(struct net_device *dev)
 	if (ret)
 		goto stop;
 
+	netdev_reset_queue(dev);
 	netif_start_queue(dev);
 
 	return 0;
@@ -4464,6 +4579,89 @@ static unsigned int msc313_txqfree(u32 tsr)
 	return qlen;
 }
 
+/* Transmit packet on MStar EMACs.
+ *
+ * Every TSR read is an RIU round trip, so the number of free hardware slots
+ * is cached between completions and only refreshed from TSR when it runs
+ * out. The overrun check after each frame is the one TSR read left on the
+ * fast path. It can't be batched over xmit_more frames: the EMAC has no
+ * doorbell separate from the per-frame TAR/TCR writes, and an OVR seen at
+ * the end of a batch doesn't say which of the frames was dropped.
+ *
+ * A rejected frame goes back to the stack with the queue stopped, the TX
+ * completion interrupt wakes it once the EMAC has room again.
+ */
+static netdev_tx_t msc313_start_xmit(struct sk_buff *skb,
+				     struct net_device *dev)
+{
+	struct macb *lp = netdev_priv(dev);
+	struct macb_tx_skb *tx_skb;
+	unsigned long flags;
+	dma_addr_t mapping;
+	unsigned int len = skb->len;
+	u32 tsr;
+
+	mapping = dma_map_single(&lp->pdev->dev, skb->data, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(&lp->pdev->dev, mapping)) {
+		dev_kfree_skb_any(skb);
+		dev->stats.tx_dropped++;
+		netdev_err(dev, "%s: DMA mapping error\n", __func__);
+		return NETDEV_TX_OK;
+	}
+
+	spin_lock_irqsave(&lp->lock, flags);
+
+	if (!lp->rm9200_tx_free)
+		lp->rm9200_tx_free = msc313_txqfree(macb_readl(lp, TSR));
+
+	if (lp->rm9200_tx_len == lp->rm9200_txq_len || !lp->rm9200_tx_free) {
+		netif_stop_queue(dev);
+		spin_unlock_irqrestore(&lp->lock, flags);
+		dma_unmap_single(&lp->pdev->dev, mapping, len, DMA_TO_DEVICE);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* Store packet information (to free when Tx completed) */
+	tx_skb = &lp->rm9200_txq[lp->rm9200_tx_tail];
+	tx_skb->skb = skb;
+	tx_skb->size = len;
+	tx_skb->mapping = mapping;
+
+	/* Set address of the data in the Transmit Address register */
+	macb_writel(lp, TAR, mapping);
+	/* Set length of the packet in the Transmit Control register */
+	macb_writel(lp, TCR, len);
+
+	/* Check that the frame was actually accepted */
+	tsr = macb_readl(lp, TSR);
+	lp->rm9200_tx_free = msc313_txqfree(tsr);
+	if (tsr & MACB_BIT(RM9200_OVR)) {
+		/* Seems not, hand it back to the stack to retry */
+		macb_writel(lp, TSR, MACB_BIT(RM9200_OVR));
+		tx_skb->skb = NULL;
+		dev->stats.tx_fifo_errors++;
+		netif_stop_queue(dev);
+		spin_unlock_irqrestore(&lp->lock, flags);
+		dma_unmap_single(&lp->pdev->dev, mapping, len, DMA_TO_DEVICE);
+		if (net_ratelimit())
+			netdev_err(dev, "%s: tx overrun, tsr: %08x\n",
+				   __func__, tsr);
+		return NETDEV_TX_BUSY;
+	}
+
+	lp->rm9200_tx_tail = (lp->rm9200_tx_tail + 1) % lp->rm9200_txq_len;
+	lp->rm9200_tx_len++;
+	netdev_sent_queue(dev, len);
+
+	/* Stop the queue if we are full up */
+	if (lp->rm9200_tx_len == lp->rm9200_txq_len || !lp->rm9200_tx_free)
+		netif_stop_queue(dev);
+
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	return NETDEV_TX_OK;
+}
+
 /* Transmit packet */
 static netdev_tx_t at91ether_start_xmit(struct sk_buff *skb,
 					struct net_device *dev)
@@ -4473,6 +4671,9 @@ static netdev_tx_t at91ether_start_xmit(struct sk_buff *skb,
 	unsigned long flags;
 	u32 tsr, tsr_pre;
 
+	if (lp->caps & MACB_CAPS_MSTAR_TXQ)
+		return msc313_start_xmit(skb, dev);
+
 	spin_lock_irqsave(&lp->lock, flags);
 
 	/* txq is full but xmit got called somehow */
@@ -4481,11 +4682,7 @@ static netdev_tx_t at91ether_start_xmit(struct sk_buff *skb,
 
 	/* check TSR just in case we lost track */
 	tsr = macb_readl(lp, TSR);
-	if (lp->caps & MACB_CAPS_MSTAR_TXQ) {
-		if (msc313_txqfree(tsr) == 0)
-			goto busy_quiet;
-	}
-	else if (at91ether_txqfree(tsr) == 0)
+	if (at91ether_txqfree(tsr) == 0)
 		goto busy;
 
 	/* Store packet information (to free when Tx completed) */
@@ -4522,6 +4719,7 @@ static netdev_tx_t at91ether_start_xmit(struct sk_buff *skb,
 	/* Pretty sure the frame is actually going to be transmitted now */
 	lp->rm9200_tx_tail = (desc + 1) % lp->rm9200_txq_len;
 	lp->rm9200_tx_len++;
+	netdev_sent_queue(dev, skb->len);
 
 	/* Stop the queue if we are full up */
 	if (lp->rm9200_tx_len == lp->rm9200_txq_len)
@@ -4584,11 +4782,148 @@ static void at91ether_rx(struct net_device *dev)
 	}
 }
 
+/* Pass a frame received into a page_pool page up the stack. Small frames are
+ * copied so that the page can go straight back to the hardware, larger ones
+ * are handed over in place and the page is swapped for a fresh one from the
+ * pool. Returns NULL if the frame has to be dropped.
+ */
+static struct sk_buff *at91ether_rx_page(struct macb *lp,
+					 struct napi_struct *napi,
+					 struct macb_dma_desc *desc,
+					 unsigned int pktlen)
+{
+	struct macb_queue *q = &lp->queues[0];
+	struct page *page = q->rx_page[q->rx_tail];
+	dma_addr_t addr = page_pool_get_dma_addr(page) + AT91ETHER_PP_HEADROOM;
+	void *data = page_address(page) + AT91ETHER_RX_OFFSET;
+	struct sk_buff *skb;
+	struct page *new;
+
+	dma_sync_single_for_cpu(&lp->pdev->dev, addr, pktlen + NET_IP_ALIGN,
+				DMA_FROM_DEVICE);
+
+	new = NULL;
+	if (pktlen > lp->rx_copybreak) {
+		new = page_pool_dev_alloc_pages(q->page_pool);
+		if (!new)
+			lp->rx_pp_stats.rx_alloc_failed++;
+	}
+
+	if (!new) {
+		/* Copy the frame out and give the page back to the hardware */
+		skb = napi_alloc_skb(napi, pktlen);
+		if (skb) {
+			skb_put_data(skb, data, pktlen);
+			lp->rx_pp_stats.rx_copied++;
+		}
+		dma_sync_single_for_device(&lp->pdev->dev, addr,
+					   pktlen + NET_IP_ALIGN,
+					   DMA_FROM_DEVICE);
+		return skb;
+	}
+
+	skb = napi_build_skb(page_address(page), PAGE_SIZE);
+	if (!skb) {
+		page_pool_recycle_direct(q->page_pool, new);
+		dma_sync_single_for_device(&lp->pdev->dev, addr,
+					   pktlen + NET_IP_ALIGN,
+					   DMA_FROM_DEVICE);
+		return NULL;
+	}
+
+	skb_reserve(skb, AT91ETHER_RX_OFFSET);
+	skb_put(skb, pktlen);
+	skb_mark_for_recycle(skb);
+	lp->rx_pp_stats.rx_recycled++;
+
+	q->rx_page[q->rx_tail] = new;
+	addr = page_pool_get_dma_addr(new) + AT91ETHER_PP_HEADROOM;
+	if (q->rx_tail == AT91ETHER_NAPI_RX_DESCR - 1)
+		addr |= MACB_BIT(RX_WRAP);
+	/* RX_USED is clear in the new address, so this hands the slot back */
+	macb_set_addr(lp, desc, addr);
+
+	return skb;
+}
+
+/* NAPI counterpart of at91ether_rx(), called with RCOMP masked */
+static int at91ether_rx_napi(struct macb *lp, struct napi_struct *napi,
+			     int budget)
+{
+	struct macb_queue *q = &lp->queues[0];
+	struct net_device *dev = lp->dev;
+	struct macb_dma_desc *desc;
+	struct sk_buff *skb;
+	unsigned int pktlen;
+	int work_done = 0;
+
+	while (work_done < budget) {
+		desc = macb_rx_desc(q, q->rx_tail);
+		if (!(desc->addr & MACB_BIT(RX_USED)))
+			break;
+
+		/* Ensure ctrl is at least as up-to-date as addr */
+		dma_rmb();
+
+		pktlen = MACB_BF(RX_FRMLEN, desc->ctrl);
+		if (desc->ctrl & MACB_BIT(RX_MHASH_MATCH))
+			dev->stats.multicast++;
+
+		skb = at91ether_rx_page(lp, napi, desc, pktlen);
+		if (skb) {
+			skb->protocol = eth_type_trans(skb, dev);
+			dev->stats.rx_packets++;
+			dev->stats.rx_bytes += pktlen;
+			napi_gro_receive(napi, skb);
+		} else {
+			dev->stats.rx_dropped++;
+		}
+
+		/* reset ownership bit, a no-op if the page was swapped */
+		desc->addr &= ~MACB_BIT(RX_USED);
+
+		/* wrap after last buffer */
+		if (q->rx_tail == AT91ETHER_NAPI_RX_DESCR - 1)
+			q->rx_tail = 0;
+		else
+			q->rx_tail++;
+
+		work_done++;
+	}
+
+	return work_done;
+}
+
+static int at91ether_rx_poll(struct napi_struct *napi, int budget)
+{
+	struct macb_queue *q = container_of(napi, struct macb_queue, napi_rx);
+	struct macb *lp = q->bp;
+	int work_done;
+
+	work_done = at91ether_rx_napi(lp, napi, budget);
+
+	if (work_done < budget && napi_complete_done(napi, work_done)) {
+		macb_writel(lp, IER, AT91ETHER_RX_INT_FLAGS);
+
+		/* RCOMP was cleared by the last ISR read, so a frame that
+		 * landed while it was masked won't raise a new interrupt.
+		 */
+		if (macb_rx_desc(q, q->rx_tail)->addr & MACB_BIT(RX_USED) &&
+		    napi_schedule_prep(napi)) {
+			macb_writel(lp, IDR, AT91ETHER_RX_INT_FLAGS);
+			__napi_schedule(napi);
+		}
+	}
+
+	return work_done;
+}
+
 /* MAC interrupt handler */
 static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = dev_id;
 	struct macb *lp = netdev_priv(dev);
+	unsigned int pkts = 0, bytes = 0;
 	u32 intstatus, ctl;
 	unsigned int desc;
 	unsigned int qlen;
@@ -4602,8 +4937,14 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 	intstatus = macb_readl(lp, ISR);
 
 	/* Receive complete */
-	if (intstatus & MACB_BIT(RCOMP))
-		at91ether_rx(dev);
+	if (intstatus & MACB_BIT(RCOMP)) {
+		if (!at91ether_rx_uses_napi(lp)) {
+			at91ether_rx(dev);
+		} else if (napi_schedule_prep(&lp->queues[0].napi_rx)) {
+			macb_writel(lp, IDR, AT91ETHER_RX_INT_FLAGS);
+			__napi_schedule(&lp->queues[0].napi_rx);
+		}
+	}
 
 	/* Transmit complete */
 	if (intstatus & (MACB_BIT(TCOMP) | MACB_BIT(RM9200_TBRE))) {
@@ -4613,11 +4954,12 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 
 		tsr = macb_readl(lp, TSR);
 
-		if (lp->caps & MACB_CAPS_MSTAR_TXQ)
+		if (lp->caps & MACB_CAPS_MSTAR_TXQ) {
 			qlen = msc313_txqfree(tsr);
-		else
+			lp->rm9200_tx_free = qlen;
+		} else {
 			qlen = at91ether_txqfree(tsr);
-
+		}
 
 		while (lp->rm9200_tx_len > 0 && qlen > 0) {
 			desc = (lp->rm9200_tx_tail - lp->rm9200_tx_len) % lp->rm9200_txq_len;
@@ -4627,12 +4969,18 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 					 lp->rm9200_txq[desc].size, DMA_TO_DEVICE);
 			dev->stats.tx_packets++;
 			dev->stats.tx_bytes += lp->rm9200_txq[desc].size;
+			pkts++;
+			bytes += lp->rm9200_txq[desc].size;
 
 			lp->rm9200_tx_len--;
 			qlen--;
 		}
 
-		if (lp->rm9200_tx_len < lp->rm9200_txq_len && netif_queue_stopped(dev))
+		netdev_completed_queue(dev, pkts, bytes);
+
+		/* MStar transmits stop the queue when the EMAC has no room left */
+		if (lp->rm9200_tx_len < lp->rm9200_txq_len && netif_queue_stopped(dev) &&
+		    (!(lp->caps & MACB_CAPS_MSTAR_TXQ) || lp->rm9200_tx_free))
 			netif_wake_queue(dev);
 
 	}
@@ -4680,6 +5028,101 @@ static const struct net_device_ops at91ether_netdev_ops = {
 #endif
 };
 
+static void at91ether_get_ethtool_stats(struct net_device *dev,
+					struct ethtool_stats *stats, u64 *data)
+{
+	struct macb *lp = netdev_priv(dev);
+	unsigned long *stat = &lp->rx_pp_stats.first;
+#ifdef CONFIG_PAGE_POOL_STATS
+	struct page_pool_stats pp_stats = {};
+#endif
+	unsigned int i;
+
+	for (i = 0; i < AT91ETHER_RX_STATS_LEN; i++)
+		*data++ = stat[i];
+
+#ifdef CONFIG_PAGE_POOL_STATS
+	if (lp->queues[0].page_pool)
+		page_pool_get_stats(lp->queues[0].page_pool, &pp_stats);
+	page_pool_ethtool_stats_get(data, &pp_stats);
+#endif
+}
+
+static int at91ether_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return AT91ETHER_RX_STATS_LEN +
+		       page_pool_ethtool_stats_get_count();
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void at91ether_get_ethtool_strings(struct net_device *dev, u32 sset,
+					  u8 *p)
+{
+	unsigned int i;
+
+	switch (sset) {
+	case ETH_SS_STATS:
+		for (i = 0; i < AT91ETHER_RX_STATS_LEN; i++, p += ETH_GSTRING_LEN)
+			memcpy(p, at91ether_rx_statistics[i].stat_string,
+			       ETH_GSTRING_LEN);
+		page_pool_ethtool_stats_get_strings(p);
+		break;
+	}
+}
+
+static int at91ether_get_tunable(struct net_device *dev,
+				 const struct ethtool_tunable *tuna, void *data)
+{
+	struct macb *lp = netdev_priv(dev);
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		*(u32 *)data = lp->rx_copybreak;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int at91ether_set_tunable(struct net_device *dev,
+				 const struct ethtool_tunable *tuna,
+				 const void *data)
+{
+	struct macb *lp = netdev_priv(dev);
+
+	switch (tuna->id) {
+	case ETHTOOL_RX_COPYBREAK:
+		/* Anything above the buffer size means "always copy" */
+		lp->rx_copybreak = min_t(u32, *(u32 *)data,
+					 AT91ETHER_MAX_RBUFF_SZ);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static const struct ethtool_ops at91ether_napi_ethtool_ops = {
+	.get_regs_len		= macb_get_regs_len,
+	.get_regs		= macb_get_regs,
+	.get_link		= ethtool_op_get_link,
+	.get_ts_info		= ethtool_op_get_ts_info,
+	.get_wol		= macb_get_wol,
+	.set_wol		= macb_set_wol,
+	.get_ethtool_stats	= at91ether_get_ethtool_stats,
+	.get_strings		= at91ether_get_ethtool_strings,
+	.get_sset_count		= at91ether_get_sset_count,
+	.get_tunable		= at91ether_get_tunable,
+	.set_tunable		= at91ether_set_tunable,
+	.get_link_ksettings     = macb_get_link_ksettings,
+	.set_link_ksettings     = macb_set_link_ksettings,
+	.get_ringparam		= macb_get_ringparam,
+	.set_ringparam		= macb_set_ringparam,
+};
+
 static int at91ether_clk_init(struct platform_device *pdev, struct clk **pclk,
 			      struct clk **hclk, struct clk **tx_clk,
 			      struct clk **rx_clk, struct clk **tsu_clk)
@@ -4708,6 +5151,7 @@ static int at91ether_init(struct platform_device *pdev)
 {
 	struct net_device *dev = platform_get_drvdata(pdev);
 	struct macb *bp = netdev_priv(dev);
+	u32 ncfgr;
 	int err;
 
 	bp->queues[0].bp = bp;
@@ -4715,6 +5159,12 @@ static int at91ether_init(struct platform_device *pdev)
 	dev->netdev_ops = &at91ether_netdev_ops;
 	dev->ethtool_ops = &macb_ethtool_ops;
 
+	if (at91ether_rx_uses_napi(bp)) {
+		bp->rx_copybreak = AT91ETHER_RX_COPYBREAK;
+		dev->ethtool_ops = &at91ether_napi_ethtool_ops;
+		netif_napi_add(dev, &bp->queues[0].napi_rx, at91ether_rx_poll);
+	}
+
 	err = devm_request_irq(&pdev->dev, dev->irq, at91ether_interrupt,
 			       0, dev->name, dev);
 	if (err)
@@ -4722,7 +5172,11 @@ static int at91ether_init(struct platform_device *pdev)
 
 	macb_writel(bp, NCR, 0);
 
-	macb_writel(bp, NCFGR, MACB_BF(CLK, MACB_CLK_DIV32) | MACB_BIT(BIG));
+	ncfgr = MACB_BF(CLK, MACB_CLK_DIV32) | MACB_BIT(BIG);
+	/* Only the page_pool path knows to look past the offset */
+	if (at91ether_rx_uses_napi(bp))
+		ncfgr |= MACB_BF(RBOF, NET_IP_ALIGN);
+	macb_writel(bp, NCFGR, ncfgr);
 
 	return 0;
 }
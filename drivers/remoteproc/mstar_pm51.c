@@ -54,6 +54,9 @@
 #define MCU_P3_IN			0xbc
 #define MCU_PC				0x1f8
 
+#define PM51_SRAM_SIZE			SZ_64K
+#define PM51_DMA_TIMEOUT		msecs_to_jiffies(1000)
+
 static const struct reg_field mcu_memmap_sram_en = REG_FIELD(MCU_MEMMAP, 0, 0);
 static const struct reg_field mcu_memmap_spi_en = REG_FIELD(MCU_MEMMAP, 1, 1);
 static const struct reg_field mcu_memmap_dram_en = REG_FIELD(MCU_MEMMAP, 2, 2);
@@ -62,6 +65,12 @@ static const struct reg_field mcu_memmap_icache_rstz = REG_FIELD(MCU_MEMMAP, 3,
 static const struct reg_field pmsleep_8051_rst = REG_FIELD(MSTARV7_PMSLEEP_RSTCNTRL,
 		MSTARV7_PMSLEEP_RSTCNTRL_CPUX_SW_RSTZ_8051, MSTARV7_PMSLEEP_RSTCNTRL_CPUX_SW_RSTZ_8051);
 
+/* A run of the firmware image that needs to be copied into the SRAM */
+struct mstar_pm51_seg {
+	u32 addr;
+	u32 len;
+};
+
 struct mstar_pm51_rproc {
 	struct rproc *rproc;
 	struct platform_device *pdev;
@@ -73,8 +82,19 @@ struct mstar_pm51_rproc {
 	struct regmap_field *spi_en;
 	struct regmap_field *dram_en;
 	struct regmap_field *icache_rstz;
-	bool dma_done, dma_success;
-	wait_queue_head_t dma_wait;
+	struct dma_chan *bdma;
+	struct completion dma_done;
+	bool dma_pending, dma_success;
+
+	/*
+	 * The parsed firmware is kept mapped so that it can be put back
+	 * after resume without having to go through the ihex again.
+	 */
+	void *image;
+	dma_addr_t image_dma;
+	size_t image_len;
+	struct mstar_pm51_seg *segs;
+	unsigned int nsegs;
 };
 
 static void mstar_pm51_set_offset_sram(struct mstar_pm51_rproc *pm51, u32 start, u32 end)
@@ -101,20 +121,195 @@ static void mstar_pm51_dma_callback(void *dma_async_param,
 {
 	struct mstar_pm51_rproc *pm51 = dma_async_param;
 
-	pm51->dma_done = true;
 	pm51->dma_success = result->result == DMA_TRANS_NOERROR;
 	if(!pm51->dma_success)
 		dev_err(&pm51->pdev->dev, "dma failed: %d\n", result->result);
-	wake_up(&pm51->dma_wait);
+	complete(&pm51->dma_done);
+}
+
+static void mstar_pm51_free_image(struct mstar_pm51_rproc *pm51)
+{
+	struct device *dev = &pm51->pdev->dev;
+
+	if (!pm51->image)
+		return;
+
+	dma_unmap_single(dev, pm51->image_dma, pm51->image_len, DMA_TO_DEVICE);
+	kfree(pm51->image);
+	kfree(pm51->segs);
+	pm51->image = NULL;
+	pm51->segs = NULL;
+	pm51->nsegs = 0;
+}
+
+/*
+ * Turn the ihex records into an image that covers up to the highest
+ * address used and a list of the runs in it that actually have data,
+ * records that follow on from each other get merged into one run.
+ */
+static int mstar_pm51_parse(struct mstar_pm51_rproc *pm51, const struct firmware *fw)
+{
+	struct device *dev = &pm51->pdev->dev;
+	const struct ihex_binrec *rec;
+	struct mstar_pm51_seg *segs, *seg = NULL;
+	unsigned int nrecs = 0, nsegs = 0;
+	size_t image_len = 0;
+	dma_addr_t image_dma;
+	void *image;
+	int ret;
+
+	ret = ihex_validate_fw(fw);
+	if (ret)
+		return ret;
+
+	for (rec = (void *)fw->data; rec; rec = ihex_next_binrec(rec)) {
+		u32 addr = be32_to_cpu(rec->addr);
+		u16 len = be16_to_cpu(rec->len);
+
+		if (addr >= PM51_SRAM_SIZE || len > PM51_SRAM_SIZE - addr) {
+			dev_err(dev, "firmware record at 0x%x doesn't fit in the sram\n", addr);
+			return -EINVAL;
+		}
+
+		image_len = max_t(size_t, image_len, addr + len);
+		nrecs++;
+	}
+
+	if (!image_len)
+		return -EINVAL;
+
+	image = kzalloc(image_len, GFP_KERNEL);
+	segs = kcalloc(nrecs, sizeof(*segs), GFP_KERNEL);
+	if (!image || !segs) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	for (rec = (void *)fw->data; rec; rec = ihex_next_binrec(rec)) {
+		u32 addr = be32_to_cpu(rec->addr);
+		u16 len = be16_to_cpu(rec->len);
+
+		if (!len)
+			continue;
+
+		memcpy(image + addr, rec->data, len);
+
+		if (seg && seg->addr + seg->len == addr) {
+			seg->len += len;
+			continue;
+		}
+
+		seg = &segs[nsegs++];
+		seg->addr = addr;
+		seg->len = len;
+	}
+
+	image_dma = dma_map_single(dev, image, image_len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, image_dma)) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	mstar_pm51_free_image(pm51);
+	pm51->image = image;
+	pm51->image_dma = image_dma;
+	pm51->image_len = image_len;
+	pm51->segs = segs;
+	pm51->nsegs = nsegs;
+
+	dev_dbg(dev, "firmware is %u records in %u runs, %zu bytes\n", nrecs, nsegs, image_len);
+
+	return 0;
+
+err_free:
+	kfree(segs);
+	kfree(image);
+	return ret;
+}
+
+/* Queue up a copy of each run into the sram, this doesn't wait for it to finish */
+static int mstar_pm51_upload(struct mstar_pm51_rproc *pm51)
+{
+	struct dma_async_tx_descriptor *dmadesc;
+	struct dma_slave_config config = { };
+	unsigned int i;
+
+	regmap_field_write(pm51->sram_en, 1);
+	regmap_field_write(pm51->spi_en, 0);
+	regmap_field_write(pm51->dram_en, 0);
+	regmap_field_write(pm51->icache_rstz, 0);
+
+	reinit_completion(&pm51->dma_done);
+	pm51->dma_success = false;
+
+	config.direction = DMA_MEM_TO_DEV;
+
+	for (i = 0; i < pm51->nsegs; i++) {
+		struct mstar_pm51_seg *seg = &pm51->segs[i];
+		bool last = i == pm51->nsegs - 1;
+
+		config.dst_addr = seg->addr;
+		dmaengine_slave_config(pm51->bdma, &config);
+
+		dmadesc = dmaengine_prep_slave_single(pm51->bdma, pm51->image_dma + seg->addr,
+						      seg->len, DMA_MEM_TO_DEV,
+						      last ? DMA_PREP_INTERRUPT : 0);
+		if (!dmadesc) {
+			dmaengine_terminate_sync(pm51->bdma);
+			return -ENOMEM;
+		}
+
+		if (last) {
+			dmadesc->callback_result = mstar_pm51_dma_callback;
+			dmadesc->callback_param = pm51;
+		}
+
+		dmaengine_submit(dmadesc);
+	}
+
+	dma_async_issue_pending(pm51->bdma);
+	pm51->dma_pending = true;
+
+	return 0;
+}
+
+static int mstar_pm51_upload_wait(struct mstar_pm51_rproc *pm51)
+{
+	struct device *dev = &pm51->pdev->dev;
+	int ret = 0;
+
+	if (!pm51->dma_pending)
+		return 0;
+	pm51->dma_pending = false;
+
+	if (!wait_for_completion_timeout(&pm51->dma_done, PM51_DMA_TIMEOUT)) {
+		dev_err(dev, "timeout waiting for firmware upload\n");
+		ret = -ETIMEDOUT;
+	} else if (!pm51->dma_success)
+		ret = -EIO;
+
+	if (ret) {
+		dmaengine_terminate_sync(pm51->bdma);
+		return ret;
+	}
+
+	mstar_pm51_set_offset_sram(pm51, 0, 0x5FFF);
+
+	return 0;
 }
 
 static int mstar_pm51_rproc_start(struct rproc *rproc)
 {
 	struct mstar_pm51_rproc *pm51 = rproc->priv;
-	int i;
+	int i, ret;
 	u32 pc;
 	u8 data;
 
+	/* The upload from load() might still be going */
+	ret = mstar_pm51_upload_wait(pm51);
+	if (ret)
+		return ret;
+
 	regmap_field_write(pm51->rst, 0);
 	mdelay(50);
 	regmap_field_write(pm51->rst, 1);
@@ -139,72 +334,16 @@ static int mstar_pm51_rproc_stop(struct rproc *rproc)
 static int mstar_pm51_load(struct rproc *rproc, const struct firmware *fw)
 {
 	struct mstar_pm51_rproc *pm51 = rproc->priv;
-	struct dma_chan *bdma;
-	struct dma_async_tx_descriptor *dmadesc;
-	struct dma_slave_config config;
-	dma_addr_t dmaaddr = 0;
-	void* firmware_buf;
 	int ret;
-	struct device *dev = &pm51->pdev->dev;
-	const struct ihex_binrec *rec;
-	size_t len = 0;
 
-	regmap_field_write(pm51->sram_en, 1);
-	regmap_field_write(pm51->spi_en, 0);
-	regmap_field_write(pm51->dram_en, 0);
-	regmap_field_write(pm51->icache_rstz, 0);
+	/* Don't pull the old image out from under an upload start() never waited for */
+	mstar_pm51_upload_wait(pm51);
 
-	ret = ihex_validate_fw(fw);
+	ret = mstar_pm51_parse(pm51, fw);
 	if (ret)
 		return ret;
 
-	/*
-	 * The firmware image isn't a complete memory image
-	 * and we probably don't want to faff around DMA'ing
-	 * each little piece of it. So allocated 64K and build
-	 * a complete image there and DMA that in one go.
-	 */
-
-	firmware_buf = kzalloc(SZ_64K, GFP_KERNEL);
-	if (!firmware_buf)
-		return -ENOMEM;
-
-	for (rec = (void *)fw->data; rec; rec = ihex_next_binrec(rec)) {
-		memcpy(firmware_buf + be32_to_cpu(rec->addr), rec->data, ihex_binrec_size(rec));
-		len += ihex_binrec_size(rec);
-	}
-
-	bdma = dma_request_chan(dev, "bdma0");
-
-	if(IS_ERR(bdma)){
-		dev_warn(&rproc->dev, "failed to request bdma channel, can't upload firmware\n");
-		return -ENODEV;
-	}
-
-	dmaaddr = dma_map_single(dev, firmware_buf, SZ_64K, DMA_TO_DEVICE);
-	if (dma_mapping_error(dev, dmaaddr))
-		goto out;
-
-	pm51->dma_done = false;
-	config.direction = DMA_MEM_TO_DEV;
-	config.dst_addr = 0;
-	dmaengine_slave_config(bdma, &config);
-	dmadesc = dmaengine_prep_slave_single(bdma, dmaaddr, len, DMA_MEM_TO_DEV, 0);
-	if(dmadesc){
-		dmadesc->callback_result = mstar_pm51_dma_callback;
-		dmadesc->callback_param = pm51;
-		dmaengine_submit(dmadesc);
-		dma_async_issue_pending(bdma);
-		wait_event(pm51->dma_wait, pm51->dma_done);
-	}
-
-	mstar_pm51_set_offset_sram(pm51, 0, 0x5FFF);
-
-out:
-	dma_release_channel(bdma);
-	kfree(firmware_buf);
-
-	return 0;
+	return mstar_pm51_upload(pm51);
 }
 
 static const struct rproc_ops mstar_pm51_rproc_ops = {
@@ -232,6 +371,36 @@ static irqreturn_t mstar_pm51_irq(int irq, void *data)
 	return IRQ_HANDLED;
 }
 
+static void mstar_pm51_release(void *data)
+{
+	struct mstar_pm51_rproc *pm51 = data;
+
+	mstar_pm51_upload_wait(pm51);
+	mstar_pm51_free_image(pm51);
+	dma_release_channel(pm51->bdma);
+}
+
+/* The sram doesn't survive suspend so put the firmware back and restart */
+static int mstar_pm51_resume(struct device *dev)
+{
+	struct rproc *rproc = dev_get_drvdata(dev);
+	struct mstar_pm51_rproc *pm51 = rproc->priv;
+	int ret;
+
+	if (rproc->state != RPROC_RUNNING || !pm51->image)
+		return 0;
+
+	regmap_field_write(pm51->rst, 0);
+
+	ret = mstar_pm51_upload(pm51);
+	if (ret)
+		return ret;
+
+	return mstar_pm51_rproc_start(rproc);
+}
+
+static DEFINE_SIMPLE_DEV_PM_OPS(mstar_pm51_pm_ops, NULL, mstar_pm51_resume);
+
 static int mstar_pm51_rproc_probe(struct platform_device *pdev)
 {
 	struct device *dev = &pdev->dev;
@@ -287,7 +456,16 @@ static int mstar_pm51_rproc_probe(struct platform_device *pdev)
 	if (ret)
 		return ret;
 
-	init_waitqueue_head(&pm51->dma_wait);
+	pm51->bdma = dma_request_chan(dev, "bdma0");
+	if (IS_ERR(pm51->bdma))
+		return dev_err_probe(dev, PTR_ERR(pm51->bdma),
+				     "failed to request bdma channel\n");
+
+	ret = devm_add_action_or_reset(dev, mstar_pm51_release, pm51);
+	if (ret)
+		return ret;
+
+	init_completion(&pm51->dma_done);
 
 	dev_set_drvdata(dev, rproc);
 
@@ -299,6 +477,7 @@ static struct platform_driver mstar_pm51_rproc_driver = {
 	.driver = {
 		.name = "mstar_pm51",
 		.of_match_table = mstar_pm51_rproc_of_match,
+		.pm = pm_sleep_ptr(&mstar_pm51_pm_ops),
 	},
 };
 
@@ -12,11 +12,13 @@
 #include <linux/spi/spi.h>
 #include <linux/spi/spi-mem.h>
 #include <linux/delay.h>
+#include <linux/iopoll.h>
 #include <linux/clk.h>
 #include <linux/regmap.h>
 #include <linux/dmaengine.h>
 #include <linux/dma-mapping.h>
 #include <linux/clk-provider.h>
+#include <linux/sizes.h>
 
 #include <dt-bindings/dma/msc313-bdma.h>
 
@@ -47,6 +49,19 @@
 
 //#define DISABLE_BDMA
 
+/*
+ * Reads shorter than this come straight out of the memory mapped window,
+ * for anything this small mapping the buffer and setting up the BDMA
+ * costs more than the copy.
+ */
+#define DIRMAP_DMA_THRESHOLD_DEFAULT	1024
+
+/* Largest chunk handed to the BDMA in one descriptor */
+#define DIRMAP_DMA_CHUNK		SZ_64K
+
+/* How long to wait for the ISP to shift a byte in/out */
+#define ISP_BYTE_TIMEOUT_US		1000
+
 static const struct regmap_config msc313_isp_isp_regmap_config = {
 	.name = "isp",
 	.reg_bits = 16,
@@ -62,11 +77,6 @@ static const struct regmap_config msc313_isp_qspi_regmap_config = {
 };
 
 static const struct reg_field rst_nrst_field = REG_FIELD(REG_RST, 2, 2);
-static const struct reg_field readreq_req_field = REG_FIELD(REG_SPI_RDREQ, 0, 0);
-static const struct reg_field rdata_field = REG_FIELD(REG_SPI_RDATA, 0, 7);
-static const struct reg_field rddatardy_ready_field = REG_FIELD(REG_SPI_RD_DATARDY, 0, 0);
-static const struct reg_field wdata_field = REG_FIELD(REG_SPI_WDATA, 0, 7);
-static const struct reg_field wrdatardy_ready_field = REG_FIELD(REG_SPI_WR_DATARDY, 0, 0);
 static const struct reg_field ceclr_clear_field = REG_FIELD(REG_SPI_CECLR, 0, 0);
 
 #define REG_QSPI_CFG			0x1c0
@@ -99,11 +109,6 @@ struct msc313_isp {
 	struct dma_chan *dmachan;
 
 	struct regmap_field *nrst;
-	struct regmap_field *rdreq;
-	struct regmap_field *rdata;
-	struct regmap_field *rddatardy;
-	struct regmap_field *wdata;
-	struct regmap_field *wrdatardy;
 	struct regmap_field *ceclr;
 
 	struct regmap_field *addr2;
@@ -111,6 +116,12 @@ struct msc313_isp {
 
 	struct completion dma_done;
 	bool dma_success;
+
+	/* dirmap read policy and stats */
+	unsigned int dirmap_dma_threshold;
+	u64 dirmap_memcpy_reads, dirmap_memcpy_bytes;
+	u64 dirmap_dma_reads, dirmap_dma_bytes;
+	u64 dirmap_dma_failures;
 };
 
 struct msc313_qspi_readmode {
@@ -145,29 +156,49 @@ static void msc313_isp_disable(struct msc313_isp *isp)
 	//regmap_field_force_write(isp->nrst, 0);
 }
 
-static void msc313_isp_spi_writebyte(struct msc313_isp *isp, u8 value)
+/*
+ * The ISP only has a single byte data register in each direction so
+ * every byte needs a ready check. These skip regmap and its locking
+ * and spin on the ready bit directly, which usually is already set
+ * by the time we look as the SPI clock is much faster than the RIU.
+ */
+static int msc313_isp_spi_write(struct msc313_isp *isp, const u8 *buf, unsigned int len)
 {
-	unsigned int rdyval;
+	unsigned int i;
+	u16 rdy;
+	int ret;
 
-	regmap_field_force_write(isp->wdata, value);
-	if(regmap_field_read_poll_timeout(isp->wrdatardy, rdyval,
-			rdyval & BIT_SPI_WR_DATARDY_READY, 0, 1000000)){
-		dev_err(&isp->master->dev, "write timeout");
+	for (i = 0; i < len; i++) {
+		writew_relaxed(buf[i], isp->base + REG_SPI_WDATA);
+		ret = readw_relaxed_poll_timeout_atomic(isp->base + REG_SPI_WR_DATARDY,
+				rdy, rdy & BIT_SPI_WR_DATARDY_READY, 0, ISP_BYTE_TIMEOUT_US);
+		if (ret) {
+			dev_err(&isp->master->dev, "write timeout");
+			return ret;
+		}
 	}
+
+	return 0;
 }
 
-static void msc313_isp_spi_readbyte(struct msc313_isp *isp, u8 *dest)
+static int msc313_isp_spi_read(struct msc313_isp *isp, u8 *buf, unsigned int len)
 {
-	unsigned int rdyval;
-	unsigned int regval;
+	unsigned int i;
+	u16 rdy;
+	int ret;
 
-	regmap_field_force_write(isp->rdreq, 1);
-	if(regmap_field_read_poll_timeout(isp->rddatardy, rdyval,
-				rdyval & BIT_SPI_RD_DATARDY_READY, 0, 1000000)){
-		dev_err(&isp->master->dev, "read timeout");
+	for (i = 0; i < len; i++) {
+		writew_relaxed(1, isp->base + REG_SPI_RDREQ);
+		ret = readw_relaxed_poll_timeout_atomic(isp->base + REG_SPI_RD_DATARDY,
+				rdy, rdy & BIT_SPI_RD_DATARDY_READY, 0, ISP_BYTE_TIMEOUT_US);
+		if (ret) {
+			dev_err(&isp->master->dev, "read timeout");
+			return ret;
+		}
+		buf[i] = readw_relaxed(isp->base + REG_SPI_RDATA);
 	}
-	regmap_field_read(isp->rdata, &regval);
-	*dest = (u8) regval;
+
+	return 0;
 }
 
 static void msc313_isp_spi_clearcs(struct msc313_isp *isp)
@@ -190,30 +221,20 @@ static int msc313_isp_transfer_one(struct spi_controller *ctlr, struct spi_devic
 			    struct spi_transfer *transfer)
 {
 	struct msc313_isp *isp = spi_controller_get_devdata(ctlr);
-	const u8 *tx_buf = transfer->tx_buf;
-	u8 *rx_buf = transfer->rx_buf;
-	unsigned b = 0;
+	int ret = 0;
 
 	/*
 	 * this only really works for SPI NOR <cs low><write something><read something><cs high>
-	 * transactions
+	 * transactions, we don't do full duplex so tx wins if both are set.
 	 */
-
-	for(b = 0; b < transfer->len; b++) {
-		if (tx_buf) {
-			msc313_isp_spi_writebyte(isp, *tx_buf++);
-			/* we don't do full duplex, there should be no rx buffer */
-			if(rx_buf){
-			}
-		}
-		else if(rx_buf){
-			msc313_isp_spi_readbyte(isp, rx_buf++);
-		}
-	}
+	if (transfer->tx_buf)
+		ret = msc313_isp_spi_write(isp, transfer->tx_buf, transfer->len);
+	else if (transfer->rx_buf)
+		ret = msc313_isp_spi_read(isp, transfer->rx_buf, transfer->len);
 
 	spi_finalize_current_transfer(ctlr);
 
-	return 0;
+	return ret;
 }
 
 static void msc313_isp_set_cs(struct spi_device *spi, bool enable)
@@ -256,29 +277,37 @@ static bool msc313_isp_spi_mem_supports_op(struct spi_mem *mem,
 static int msc313_isp_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 {
 	struct msc313_isp *isp = spi_controller_get_devdata(mem->spi->controller);
-	int i, ret = 0;
-
-	if(op->cmd.opcode)
-		msc313_isp_spi_writebyte(isp, op->cmd.opcode);
-	if(op->addr.nbytes != 0)
-		for(i = op->addr.nbytes; i > 0; i--)
-			msc313_isp_spi_writebyte(isp, (op->addr.val >> (8 * (i - 1))) & 0xff);
-	if(op->dummy.nbytes != 0)
-		for(i = 0; i < op->dummy.nbytes; i++)
-			msc313_isp_spi_writebyte(isp, 0xff);
-	switch(op->data.dir){
-		case SPI_MEM_DATA_IN:
-			for(i = 0; i < op->data.nbytes; i++)
-				msc313_isp_spi_readbyte(isp, ((u8*)(op->data.buf.in + i)));
-			break;
-		case SPI_MEM_DATA_OUT:
-			for(i = 0; i < op->data.nbytes; i++)
-				msc313_isp_spi_writebyte(isp, *((u8*)(op->data.buf.out + i)));
-			break;
-		case SPI_MEM_NO_DATA:
-			break;
+	/* opcode, up to 4 address bytes and the dummy bytes */
+	u8 hdr[1 + 4 + 8];
+	unsigned int hdrlen = 0;
+	int i, ret;
+
+	if (op->addr.nbytes > 4 || op->dummy.nbytes > 8)
+		return -EINVAL;
+
+	if (op->cmd.opcode)
+		hdr[hdrlen++] = op->cmd.opcode;
+	for (i = op->addr.nbytes; i > 0; i--)
+		hdr[hdrlen++] = (op->addr.val >> (8 * (i - 1))) & 0xff;
+	for (i = 0; i < op->dummy.nbytes; i++)
+		hdr[hdrlen++] = 0xff;
+
+	ret = msc313_isp_spi_write(isp, hdr, hdrlen);
+	if (ret)
+		goto out;
+
+	switch (op->data.dir) {
+	case SPI_MEM_DATA_IN:
+		ret = msc313_isp_spi_read(isp, op->data.buf.in, op->data.nbytes);
+		break;
+	case SPI_MEM_DATA_OUT:
+		ret = msc313_isp_spi_write(isp, op->data.buf.out, op->data.nbytes);
+		break;
+	case SPI_MEM_NO_DATA:
+		break;
 	}
 
+out:
 	msc313_isp_spi_clearcs(isp);
 	return ret;
 }
@@ -334,17 +363,90 @@ static void msc313_isp_dma_callback(void *dma_async_param,
 	complete(&isp->dma_done);
 }
 
+/*
+ * Read a large block with the BDMA. The buffer might come from vmalloc
+ * (UBIFS does this) so it's mapped as an sg list that is split into
+ * chunks of at most DIRMAP_DMA_CHUNK. All of the chunks are queued
+ * before the BDMA is kicked so that it can move onto the next chunk
+ * as soon as one finishes, only the last one needs to call us back.
+ */
+static int msc313_isp_spi_mem_dirmap_read_dma(struct msc313_isp *isp,
+		struct spi_mem_dirmap_desc *desc, u64 offs, size_t len, void *buf)
+{
+	struct spi_mem_op op = desc->info.op_tmpl;
+	struct dma_async_tx_descriptor *dmadesc;
+	struct dma_slave_config config = { };
+	struct scatterlist *sg;
+	struct sg_table sgt;
+	int i, ret;
+
+	op.data.nbytes = len;
+	op.data.buf.in = buf;
+
+	ret = spi_controller_dma_map_mem_op_data(isp->master, &op, &sgt);
+	if (ret)
+		return ret;
+
+	reinit_completion(&isp->dma_done);
+
+	config.direction = DMA_DEV_TO_MEM;
+	for_each_sgtable_dma_sg(&sgt, sg, i) {
+		bool last = i == sgt.nents - 1;
+
+		config.src_addr = offs;
+		dmaengine_slave_config(isp->dmachan, &config);
+
+		dmadesc = dmaengine_prep_slave_single(isp->dmachan,
+				sg_dma_address(sg), sg_dma_len(sg), DMA_DEV_TO_MEM,
+				last ? DMA_PREP_INTERRUPT : 0);
+		if (!dmadesc) {
+			ret = -ENOMEM;
+			goto terminate;
+		}
+
+		if (last) {
+			dmadesc->callback_result = msc313_isp_dma_callback;
+			dmadesc->callback_param = isp;
+		}
+
+		dmaengine_submit(dmadesc);
+		offs += sg_dma_len(sg);
+	}
+
+	dma_async_issue_pending(isp->dmachan);
+
+	/*
+	 * If the settings are wrong DMA doesn't complete..
+	 * The BDMA driver implements a timeout now so this should never
+	 * deadlock but in the past DMA failing caused the hardware to
+	 * lock up when trying to trigger another transfer. Don't wait
+	 * forever just in case.
+	 */
+	if (!wait_for_completion_timeout(&isp->dma_done, HZ))
+		ret = -ETIMEDOUT;
+	else if (!isp->dma_success)
+		ret = -EIO;
+
+terminate:
+	if (ret)
+		dmaengine_terminate_sync(isp->dmachan);
+	spi_controller_dma_unmap_mem_op_data(isp->master, &op, &sgt);
+
+	return ret;
+}
+
 static ssize_t msc313_isp_spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
 		u64 offs, size_t len, void *buf)
 {
 	struct msc313_isp *isp = spi_controller_get_devdata(desc->mem->spi->controller);
 	const struct msc313_qspi_readmode *readmode = desc->priv;
 	struct spi_mem_op *tmpl = &desc->info.op_tmpl;
-	struct dma_async_tx_descriptor *dmadesc;
-	struct dma_slave_config config;
-	dma_addr_t dmaaddr = 0;
 
-	msc313_isp_disable(isp);
+	if (offs >= isp->mapped_size)
+		return -EINVAL;
+
+	/* spi-mem will come back for the rest */
+	len = min_t(u64, len, isp->mapped_size - offs);
 
 	/* Make sure we generate the right number of address bytes */
 	if (tmpl->addr.nbytes == 2)
@@ -354,6 +456,8 @@ static ssize_t msc313_isp_spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
 	else
 		return -EINVAL;
 
+	msc313_isp_disable(isp);
+
 	regmap_write(isp->qspi, REG_QSPI_READMODE, readmode->readmode);
 
 	/*
@@ -387,51 +491,82 @@ static ssize_t msc313_isp_spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
 	 */
 	regmap_field_write(isp->addrcontdis, 1);
 
-	if (isp->dmachan) {
-		dmaaddr = dma_map_single(isp->dev, buf, len, DMA_FROM_DEVICE);
-		if (dma_mapping_error(isp->dev, dmaaddr)){
-			dmaaddr = 0;
-			goto memcpy;
+	if (isp->dmachan && len >= READ_ONCE(isp->dirmap_dma_threshold)) {
+		if (!msc313_isp_spi_mem_dirmap_read_dma(isp, desc, offs, len, buf)) {
+			isp->dirmap_dma_reads++;
+			isp->dirmap_dma_bytes += len;
+			goto out;
 		}
 
-		config.direction = DMA_DEV_TO_MEM;
-		config.src_addr = offs;
-		dmaengine_slave_config(isp->dmachan, &config);
-		dmadesc = dmaengine_prep_slave_single(isp->dmachan, dmaaddr, len, DMA_DEV_TO_MEM, 0);
-		if(dmadesc){
-			dmadesc->callback_result = msc313_isp_dma_callback;
-			dmadesc->callback_param = isp;
-			dmaengine_submit(dmadesc);
-			dma_async_issue_pending(isp->dmachan);
-			/*
-			 * If the settings are wrong DMA doesn't complete..
-			 * The BDMA driver implements a timeout now so this should never
-			 * deadlock but in the past DMA failing caused the hardware to
-			 * lock up when trying to trigger another transfer. I guess
-			 * we'll see if that happens anymore.
-			 */
-			wait_for_completion(&isp->dma_done);
-			if(isp->dma_success)
-				goto dma_exit;
-			else
-				dev_warn(&isp->master->dev, "dma failed, falling back to cpu read\n");
-		}
+		isp->dirmap_dma_failures++;
+		dev_warn_ratelimited(&isp->master->dev,
+				     "dma failed, falling back to cpu read\n");
 	}
 
 	/*
 	 * Despite the documentation saying not to do this on the
-	 * cpu we don't have a lot of choice if dma isn't working.
+	 * cpu we don't have a lot of choice if dma isn't working
+	 * and for small reads it's faster anyhow.
 	 */
-memcpy:
-	memcpy(buf, isp->memorymapped + offs, len);
-dma_exit:
-	if(dmaaddr)
-		dma_unmap_single(isp->dev, dmaaddr, len, DMA_FROM_DEVICE);
+	memcpy_fromio(buf, isp->memorymapped + offs, len);
+	isp->dirmap_memcpy_reads++;
+	isp->dirmap_memcpy_bytes += len;
+
+out:
 	msc313_isp_enable(isp);
 
 	return len;
 }
 
+static ssize_t dirmap_dma_threshold_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct spi_master *master = dev_get_drvdata(dev);
+	struct msc313_isp *isp = spi_master_get_devdata(master);
+
+	return sysfs_emit(buf, "%u\n", isp->dirmap_dma_threshold);
+}
+
+static ssize_t dirmap_dma_threshold_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct spi_master *master = dev_get_drvdata(dev);
+	struct msc313_isp *isp = spi_master_get_devdata(master);
+	unsigned int threshold;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &threshold);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(isp->dirmap_dma_threshold, threshold);
+
+	return count;
+}
+static DEVICE_ATTR_RW(dirmap_dma_threshold);
+
+static ssize_t dirmap_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct spi_master *master = dev_get_drvdata(dev);
+	struct msc313_isp *isp = spi_master_get_devdata(master);
+
+	return sysfs_emit(buf,
+			  "memcpy reads: %llu, bytes: %llu\n"
+			  "dma reads: %llu, bytes: %llu, failures: %llu\n",
+			  isp->dirmap_memcpy_reads, isp->dirmap_memcpy_bytes,
+			  isp->dirmap_dma_reads, isp->dirmap_dma_bytes,
+			  isp->dirmap_dma_failures);
+}
+static DEVICE_ATTR_RO(dirmap_stats);
+
+static struct attribute *msc313_isp_attrs[] = {
+	&dev_attr_dirmap_dma_threshold.attr,
+	&dev_attr_dirmap_stats.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(msc313_isp);
+
 static struct spi_controller_mem_ops msc313_isp_mem_ops = {
 	.supports_op = msc313_isp_spi_mem_supports_op,
 	.exec_op = msc313_isp_exec_op,
@@ -480,11 +615,6 @@ static int msc313_isp_probe(struct platform_device *pdev)
 	isp->isp = devm_regmap_init_mmio(&pdev->dev, isp->base,
 			&msc313_isp_isp_regmap_config);
 	isp->nrst = devm_regmap_field_alloc(&pdev->dev, isp->isp, rst_nrst_field);
-	isp->rdreq = devm_regmap_field_alloc(&pdev->dev, isp->isp, readreq_req_field);
-	isp->rdata = devm_regmap_field_alloc(&pdev->dev, isp->isp, rdata_field);
-	isp->rddatardy = devm_regmap_field_alloc(&pdev->dev, isp->isp, rddatardy_ready_field);
-	isp->wdata = devm_regmap_field_alloc(&pdev->dev, isp->isp, wdata_field);
-	isp->wrdatardy = devm_regmap_field_alloc(&pdev->dev, isp->isp, wrdatardy_ready_field);
 	isp->ceclr = devm_regmap_field_alloc(&pdev->dev, isp->isp, ceclr_clear_field);
 
 	base = devm_platform_ioremap_resource(pdev, 2);
@@ -552,6 +682,9 @@ static int msc313_isp_probe(struct platform_device *pdev)
 	master->mem_ops = &msc313_isp_mem_ops;
 #endif
 	init_completion(&isp->dma_done);
+	isp->dirmap_dma_threshold = DIRMAP_DMA_THRESHOLD_DEFAULT;
+	/* Makes spi-mem split the dirmap sg lists into BDMA sized chunks */
+	master->max_dma_len = DIRMAP_DMA_CHUNK;
 
 	ret = clk_prepare_enable(isp->pm_spi_clk);
 	ret = clk_prepare_enable(isp->spi_div_clk);
@@ -625,6 +758,7 @@ static struct platform_driver msc313_isp_driver = {
 	.driver	= {
 		.name = DRIVER_NAME,
 		.of_match_table = msc313_isp_match,
+		.dev_groups = msc313_isp_groups,
 		.pm = &msc313_isp_pm_ops
 	},
 };
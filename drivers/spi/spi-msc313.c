@@ -7,6 +7,7 @@
 #include <linux/gpio.h>
 #include <linux/interrupt.h>
 #include <linux/iopoll.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of_platform.h>
 #include <linux/reset.h>
@@ -16,6 +17,8 @@
 #include <linux/clk-provider.h>
 #include <linux/dmaengine.h>
 #include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 
 #ifdef CONFIG_MACH_PIONEER3
 #include <linux/mfd/syscon.h>
@@ -109,6 +112,20 @@ static const struct reg_field dmarw_field	= REG_FIELD(REG_DMARW, 0, 0);
  */
 #define DMA_MIN		32
 
+/*
+ * Below this many bytes a transfer is done with PIO, setting up
+ * the DMA costs more than pushing a few FIFO loads. Can be changed
+ * via debugfs, the stats file there shows the time spent in each
+ * mode to find the crossover for a given board.
+ */
+#define DMA_THRESHOLD_DEFAULT	64
+
+/* The DMA length register is 24 bits */
+#define DMA_MAX		0xffffff
+
+/* Maximum number of sg entries in a DMA job made from merged transfers */
+#define MERGE_SG_MAX	64
+
 static const struct reg_field size_write_field	= REG_FIELD(REG_SIZE, 0, 3);
 static const struct reg_field size_read_field	= REG_FIELD(REG_SIZE, 8, 11);
 static const struct reg_field ctrl_en_field		= REG_FIELD(REG_CTRL, 0, 0);
@@ -154,6 +171,16 @@ struct msc313_spi {
 	struct dma_chan *dmachan;
 	struct completion dma_done;
 	bool dma_success;
+	u32 dma_threshold;
+
+	/* transfers that have already been sent as part of a merged DMA job */
+	unsigned int merged;
+	struct scatterlist *merge_sg;
+
+	/* stats */
+	u64 pio_transfers, pio_bytes, pio_ns;
+	u64 dma_transfers, dma_bytes, dma_ns;
+	u64 dma_merged, dma_fallbacks;
 };
 
 static const struct regmap_config msc313_spi_regmap_config = {
@@ -254,20 +281,110 @@ static inline int msc313_spi_trigger(struct msc313_spi *mspi, bool dma)
 	return 0;
 }
 
+static bool msc313_spi_can_merge(struct spi_transfer *prev,
+		struct spi_transfer *next, bool read)
+{
+	/* Anything that needs to happen between the transfers stops merging */
+	if (prev->cs_change || prev->delay.value || prev->word_delay.value)
+		return false;
+
+	if (prev->cs_off != next->cs_off || prev->speed_hz != next->speed_hz)
+		return false;
+
+	if (read)
+		return next->rx_buf && !next->tx_buf;
+
+	return next->tx_buf && !next->rx_buf;
+}
+
+/*
+ * Look for transfers following first in the current message that go
+ * the same way and were mapped for DMA. If there are any, their sg
+ * entries are collected into merge_sg so that they can be sent as a
+ * single DMA job. Returns the number of transfers that were merged.
+ */
+static unsigned int msc313_spi_merge(struct msc313_spi *mspi,
+		struct spi_controller *ctlr, struct spi_transfer *first, bool read,
+		unsigned int *len, struct scatterlist **sgl, unsigned int *nents)
+{
+	struct list_head *transfers = &ctlr->cur_msg->transfers;
+	struct device *dmadev = read ? ctlr->cur_rx_dma_dev : ctlr->cur_tx_dma_dev;
+	enum dma_data_direction dmadir = read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	unsigned int count = 0, total = *len, n = *nents;
+	struct spi_transfer *prev = first, *next;
+	struct scatterlist *src, *dst;
+	int i, j;
+
+	while (!list_is_last(&prev->transfer_list, transfers)) {
+		struct sg_table *sgt;
+
+		next = list_next_entry(prev, transfer_list);
+		if (!msc313_spi_can_merge(prev, next, read))
+			break;
+
+		sgt = read ? &next->rx_sg : &next->tx_sg;
+		if (!sgt->nents ||
+		    n + sgt->nents > MERGE_SG_MAX ||
+		    total + next->len > DMA_MAX)
+			break;
+
+		n += sgt->nents;
+		total += next->len;
+		count++;
+		prev = next;
+	}
+
+	if (!count)
+		return 0;
+
+	sg_init_table(mspi->merge_sg, n);
+	dst = mspi->merge_sg;
+	next = first;
+	for (i = 0; i <= count; i++) {
+		struct sg_table *sgt = read ? &next->rx_sg : &next->tx_sg;
+
+		/*
+		 * The core only syncs a transfer right before it's
+		 * turn, the merged ones are going now.
+		 */
+		if (next != first)
+			dma_sync_sgtable_for_device(dmadev, sgt, dmadir);
+
+		for_each_sgtable_dma_sg(sgt, src, j) {
+			sg_dma_address(dst) = sg_dma_address(src);
+			sg_dma_len(dst) = sg_dma_len(src);
+			dst = sg_next(dst);
+		}
+
+		next = list_next_entry(next, transfer_list);
+	}
+
+	*len = total;
+	*sgl = mspi->merge_sg;
+	*nents = n;
+
+	return count;
+}
+
 static int msc313_spi_transfer_one_dma(struct spi_controller *ctlr,
 		struct spi_device *spi, struct spi_transfer *transfer)
 {
 	struct msc313_spi *mspi = spi_controller_get_devdata(ctlr);
 	struct dma_async_tx_descriptor *dmadesc;
-	const u8 *txbuf = transfer->tx_buf;
-	unsigned int len = transfer->len;
-	u8 *rxbuf = transfer->rx_buf;
-	dma_addr_t dmaaddr = 0;
-	bool read = rxbuf ? true : false;
-	enum dma_data_direction dmadir = read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	bool read = transfer->rx_buf ? true : false;
+	struct sg_table *sgt = read ? &transfer->rx_sg : &transfer->tx_sg;
 	enum dma_transfer_direction dmatrans = read ? DMA_DEV_TO_MEM : DMA_MEM_TO_DEV;
+	struct scatterlist *sgl = sgt->sgl;
+	unsigned int nents = sgt->nents;
+	unsigned int len = transfer->len;
+	unsigned int merged;
+	ktime_t start;
 	int ret;
 
+	start = ktime_get();
+
+	merged = msc313_spi_merge(mspi, ctlr, transfer, read, &len, &sgl, &nents);
+
 	/* Setup the spi controller side of the DMA */
 	regmap_field_write(mspi->dmaen, 1);
 	regmap_field_write(mspi->dmarw, read ? 1 : 0);
@@ -276,15 +393,14 @@ static int msc313_spi_transfer_one_dma(struct spi_controller *ctlr,
 	regmap_field_write(mspi->rdsz, 0);
 	regmap_field_write(mspi->wrsz, 0);
 
-	dmaaddr = dma_map_single(mspi->dev, read ? rxbuf : txbuf, len, dmadir);
-	ret = dma_mapping_error(mspi->dev, dmaaddr);
-	if (ret)
-		return ret;
-
-	dmadesc = dmaengine_prep_slave_single(mspi->dmachan, dmaaddr, len, dmatrans, 0);
+	dmadesc = dmaengine_prep_slave_sg(mspi->dmachan, sgl, nents, dmatrans,
+					  DMA_PREP_INTERRUPT);
 	if (!dmadesc) {
-		ret = -ENOMEM;
-		goto out;
+		/* Nothing has been sent yet, let the core retry with PIO */
+		regmap_field_write(mspi->dmaen, 0);
+		mspi->dma_fallbacks++;
+		transfer->error |= SPI_TRANS_FAIL_NO_START;
+		return -EAGAIN;
 	}
 
 	dmadesc->callback_result = msc313_spi_dma_callback;
@@ -297,9 +413,15 @@ static int msc313_spi_transfer_one_dma(struct spi_controller *ctlr,
 
 	ret = msc313_spi_trigger(mspi, true);
 
-out:
 	regmap_field_write(mspi->dmaen, 0);
-	dma_unmap_single(mspi->dev, dmaaddr, len, dmadir);
+
+	if (!ret) {
+		mspi->merged = merged;
+		mspi->dma_merged += merged;
+		mspi->dma_transfers++;
+		mspi->dma_bytes += len;
+		mspi->dma_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
 
 	return ret;
 }
@@ -311,6 +433,7 @@ static int msc313_spi_transfer_one_pio(struct spi_controller *ctlr, struct spi_d
 	const u8 *txbuf = transfer->tx_buf;
 	unsigned int len = transfer->len;
 	u8 *rxbuf = transfer->rx_buf;
+	ktime_t start = ktime_get();
 	int txed = 0;
 	int ret;
 
@@ -349,11 +472,18 @@ static int msc313_spi_transfer_one_pio(struct spi_controller *ctlr, struct spi_d
 		txed += blksz;
 	}
 
+	mspi->pio_transfers++;
+	mspi->pio_bytes += len;
+	mspi->pio_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
 	return 0;
 }
 
-static bool msc313_spi_transfer_dmaok(struct msc313_spi *mspi, struct spi_transfer *transfer)
+static bool msc313_spi_can_dma(struct spi_controller *ctlr, struct spi_device *spi,
+		struct spi_transfer *transfer)
 {
+	struct msc313_spi *mspi = spi_controller_get_devdata(ctlr);
+
 	if (!mspi->dmachan)
 		return false;
 
@@ -361,7 +491,7 @@ static bool msc313_spi_transfer_dmaok(struct msc313_spi *mspi, struct spi_transf
 	if (transfer->tx_buf && transfer->rx_buf)
 		return false;
 
-	if (transfer->len < DMA_MIN)
+	if (transfer->len < max_t(u32, mspi->dma_threshold, DMA_MIN))
 		return false;
 
 	/*
@@ -376,21 +506,36 @@ static int msc313_spi_transfer_one(struct spi_controller *ctlr,
 		struct spi_device *spi, struct spi_transfer *transfer)
 {
 	struct msc313_spi *mspi = spi_controller_get_devdata(ctlr);
+	struct sg_table *sgt = transfer->rx_buf ? &transfer->rx_sg : &transfer->tx_sg;
 	int ret;
 
+	/* Already went out as part of a merged DMA job */
+	if (mspi->merged) {
+		mspi->merged--;
+		spi_finalize_current_transfer(ctlr);
+		return 0;
+	}
+
 	clk_set_rate(mspi->divider->clk, transfer->speed_hz);
 
-	if (msc313_spi_transfer_dmaok(mspi, transfer))
+	/* The core decided via can_dma() and mapped the buffers */
+	if (ctlr->cur_msg_mapped && sgt->nents)
 		ret = msc313_spi_transfer_one_dma(ctlr, spi, transfer);
 	else
 		ret = msc313_spi_transfer_one_pio(ctlr, spi, transfer);
 
+	/* Nothing was started, the core will try again with PIO */
+	if (ret == -EAGAIN && (transfer->error & SPI_TRANS_FAIL_NO_START))
+		return ret;
+
 	/*
 	 * A failed DMA transfer etc causes the controller to lock up
 	 * so if there was an error reset the controller.
 	 */
-	if (ret)
+	if (ret) {
+		mspi->merged = 0;
 		msc313_spi_reset(mspi);
+	}
 
 	//mdelay(20);
 
@@ -414,6 +559,38 @@ static irqreturn_t msc313_spi_irq(int irq, void *data)
 	return IRQ_HANDLED;
 }
 
+static int msc313_spi_stats_show(struct seq_file *s, void *data)
+{
+	struct msc313_spi *mspi = s->private;
+
+	seq_printf(s, "dma threshold: %u\n", max_t(u32, mspi->dma_threshold, DMA_MIN));
+	seq_printf(s, "pio transfers: %llu, bytes: %llu, time: %lluns\n",
+		   mspi->pio_transfers, mspi->pio_bytes, mspi->pio_ns);
+	seq_printf(s, "dma jobs: %llu, bytes: %llu, time: %lluns\n",
+		   mspi->dma_transfers, mspi->dma_bytes, mspi->dma_ns);
+	seq_printf(s, "dma merged transfers: %llu\n", mspi->dma_merged);
+	seq_printf(s, "dma fallbacks: %llu\n", mspi->dma_fallbacks);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(msc313_spi_stats);
+
+static void msc313_spi_debugfs_remove(void *data)
+{
+	debugfs_remove_recursive(data);
+}
+
+static int msc313_spi_debugfs_init(struct msc313_spi *mspi)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(mspi->dev), NULL);
+	debugfs_create_file("stats", 0444, dir, mspi, &msc313_spi_stats_fops);
+	debugfs_create_u32("dma_threshold", 0644, dir, &mspi->dma_threshold);
+
+	return devm_add_action_or_reset(mspi->dev, msc313_spi_debugfs_remove, dir);
+}
+
 static const struct clk_div_table div_table[] = {
 	{0, 2},
 	{1, 4},
@@ -595,8 +772,22 @@ static int msc313_spi_probe(struct platform_device *pdev)
 		int ret = match_data->dma_probe(spi, dev);
 		if (ret)
 			return ret;
+
+		spi->merge_sg = devm_kcalloc(dev, MERGE_SG_MAX, sizeof(*spi->merge_sg),
+					     GFP_KERNEL);
+		if (!spi->merge_sg)
+			return -ENOMEM;
+
+		spi->dma_threshold = DMA_THRESHOLD_DEFAULT;
+		master->dma_tx = spi->dmachan;
+		master->dma_rx = spi->dmachan;
+		master->can_dma = msc313_spi_can_dma;
 	}
 
+	ret = msc313_spi_debugfs_init(spi);
+	if (ret)
+		return ret;
+
 	return devm_spi_register_master(&pdev->dev, master);
 }
 
@@ -7,6 +7,7 @@
  */
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/errno.h>
 #include <linux/kernel.h>
@@ -16,27 +17,134 @@
 #include <linux/usb/usb_phy_generic.h>
 #include <linux/mfd/syscon.h>
 #include <linux/regmap.h>
+#include <linux/seq_file.h>
 #include <linux/usb/mstar_usbc.h>
 
 #include "musb_core.h"
+#include "musb_dma.h"
 
 //#define MSTAR_MUSB_DEBUG
 
+/*
+ * Requests shorter than this are moved by the CPU, setting up a DMA
+ * channel and taking the extra interrupt costs more than it saves.
+ */
+static unsigned int dma_threshold = 512;
+module_param(dma_threshold, uint, 0644);
+MODULE_PARM_DESC(dma_threshold, "Smallest request in bytes that uses DMA");
+
+struct mstar_musb_ep_stats {
+	u64 pio_tx;
+	u64 pio_rx;
+	u64 dma_tx;
+	u64 dma_rx;
+};
+
 struct mstar_glue {
 	struct platform_device	*pdev;
 	struct musb		*musb;
 	struct clk		*clk;
 	struct regmap		*usbc;
+	struct dentry		*dbgfs_root;
+
+	/* protected by musb->lock */
+	struct mstar_musb_ep_stats stats[MUSB_C_NUM_EPS];
 };
 
+static struct mstar_glue *mstar_musb_to_glue(struct musb *musb)
+{
+	return dev_get_drvdata(musb->controller->parent);
+}
+
+struct mstar_musb_dma_snap {
+	struct musb_request *req;
+	unsigned int actual;
+	unsigned int remaining;
+};
+
+/*
+ * Remember where the request on each busy DMA channel was before the
+ * DMA interrupt gets handled. By the time the handler returns the
+ * request might have been given back and the channel restarted for the
+ * next one so we can't just look at the channel afterwards.
+ */
+static void mstar_musb_dma_snapshot(struct musb_ep *musb_ep,
+				    struct mstar_musb_dma_snap *snap)
+{
+	struct musb_request *req;
+
+	snap->req = NULL;
+
+	/* Shared FIFO endpoints never set up ep_out so check dma first */
+	if (!musb_ep->dma || musb_ep->dma->status != MUSB_DMA_STATUS_BUSY)
+		return;
+
+	req = next_request(musb_ep);
+	if (!req)
+		return;
+
+	snap->req = req;
+	snap->actual = req->request.actual;
+	snap->remaining = req->request.length - req->request.actual;
+}
+
+static unsigned int mstar_musb_dma_moved(struct musb_ep *musb_ep,
+					 struct mstar_musb_dma_snap *snap)
+{
+	struct musb_request *req;
+
+	if (!snap->req)
+		return 0;
+
+	req = next_request(musb_ep);
+
+	/* Still working on the same request */
+	if (req == snap->req)
+		return req->request.actual - snap->actual;
+
+	/* The request was finished off and given back */
+	return snap->remaining;
+}
+
+static irqreturn_t mstar_musb_dma_interrupt(int irq, struct musb *musb)
+{
+	struct mstar_glue *glue = mstar_musb_to_glue(musb);
+	struct mstar_musb_dma_snap tx[MUSB_C_NUM_EPS], rx[MUSB_C_NUM_EPS];
+	struct musb_hw_ep *hw_ep;
+	unsigned long flags;
+	irqreturn_t retval;
+	int i;
+
+	spin_lock_irqsave(&musb->lock, flags);
+	for (i = 1; i < musb->nr_endpoints; i++) {
+		hw_ep = &musb->endpoints[i];
+		mstar_musb_dma_snapshot(&hw_ep->ep_in, &tx[i]);
+		mstar_musb_dma_snapshot(&hw_ep->ep_out, &rx[i]);
+	}
+	spin_unlock_irqrestore(&musb->lock, flags);
+
+	retval = dma_controller_irq(irq, musb->dma_controller);
+
+	spin_lock_irqsave(&musb->lock, flags);
+	for (i = 1; i < musb->nr_endpoints; i++) {
+		hw_ep = &musb->endpoints[i];
+		glue->stats[i].dma_tx += mstar_musb_dma_moved(&hw_ep->ep_in, &tx[i]);
+		glue->stats[i].dma_rx += mstar_musb_dma_moved(&hw_ep->ep_out, &rx[i]);
+	}
+	spin_unlock_irqrestore(&musb->lock, flags);
+
+	return retval;
+}
+
 static irqreturn_t mstar_musb_interrupt(int irq, void *__hci)
 {
 	irqreturn_t retval = IRQ_NONE, retval_dma = IRQ_NONE;
 	struct musb *musb = __hci;
 	unsigned long flags;
 
+	/* The DMA controller shares the MUSB interrupt line */
 	if (IS_ENABLED(CONFIG_USB_INVENTRA_DMA) && musb->dma_controller)
-		retval_dma = dma_controller_irq(irq, musb->dma_controller);
+		retval_dma = mstar_musb_dma_interrupt(irq, musb);
 
 	spin_lock_irqsave(&musb->lock, flags);
 
@@ -79,9 +187,44 @@ static struct musb_hdrc_platform_data mstar_musb_platform_data = {
 	.config = &mstar_musb_config,
 };
 
+static int mstar_musb_ep_stats_show(struct seq_file *s, void *unused)
+{
+	struct mstar_glue *glue = s->private;
+	struct musb *musb = glue->musb;
+	struct mstar_musb_ep_stats stats;
+	unsigned long flags;
+	int i;
+
+	seq_puts(s, "ep\tpio tx\tpio rx\tdma tx\tdma rx\n");
+
+	for (i = 0; i < musb->nr_endpoints; i++) {
+		spin_lock_irqsave(&musb->lock, flags);
+		stats = glue->stats[i];
+		spin_unlock_irqrestore(&musb->lock, flags);
+
+		seq_printf(s, "%d\t%llu\t%llu\t%llu\t%llu\n", i,
+			   stats.pio_tx, stats.pio_rx, stats.dma_tx, stats.dma_rx);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mstar_musb_ep_stats);
+
+static void mstar_musb_dbg_init(struct musb *musb, struct mstar_glue *glue)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%s.mstar", dev_name(musb->controller));
+	glue->dbgfs_root = debugfs_create_dir(buf, usb_debug_root);
+
+	debugfs_create_file("ep_stats", 0444, glue->dbgfs_root, glue,
+			    &mstar_musb_ep_stats_fops);
+}
+
 static int mstar_musb_init(struct musb *musb)
 {
 	struct device *dev = musb->controller->parent;
+	struct mstar_glue *glue = dev_get_drvdata(dev);
 	int err;
 
 	musb->phy = devm_of_phy_get_by_index(dev, dev->of_node, 0);
@@ -109,6 +252,9 @@ static int mstar_musb_init(struct musb *musb)
 
 	musb->isr = mstar_musb_interrupt;
 
+	glue->musb = musb;
+	mstar_musb_dbg_init(musb, glue);
+
 	return 0;
 
 err_phy_shutdown:
@@ -118,6 +264,10 @@ static int mstar_musb_init(struct musb *musb)
 
 static int mstar_musb_exit(struct musb *musb)
 {
+	struct mstar_glue *glue = mstar_musb_to_glue(musb);
+
+	debugfs_remove_recursive(glue->dbgfs_root);
+
 	phy_power_off(musb->phy);
 	phy_exit(musb->phy);
 
@@ -230,10 +380,16 @@ static u32 mstar_musb_fifo_offset(u8 epnum)
 	return 0x40 + (0x8 * epnum);
 }
 
+/*
+ * The FIFOs take 16 bit accesses which halves the number of trips over
+ * the RIU. 32 bit accesses aren't possible, the RIU is only 16 bits wide
+ * and splits them up which the FIFO doesn't like.
+ */
 static void mstar_musb_write_fifo(struct musb_hw_ep *hw_ep, u16 len,
 				    const u8 *src)
 {
 	struct musb *musb = hw_ep->musb;
+	struct mstar_glue *glue = mstar_musb_to_glue(musb);
 	void __iomem *fifo = hw_ep->fifo;
 
 	if (unlikely(len == 0))
@@ -242,13 +398,22 @@ static void mstar_musb_write_fifo(struct musb_hw_ep *hw_ep, u16 len,
 	dev_dbg(musb->controller, "%cX ep%d fifo %p count %d buf %p\n",
 			'T', hw_ep->epnum, fifo, len, src);
 
-	for (int i = 0; i < len; i++)
-		writeb(src[i], fifo);
+	glue->stats[hw_ep->epnum].pio_tx += len;
+
+	if (IS_ALIGNED((unsigned long)src, 2)) {
+		iowrite16_rep(fifo, src, len >> 1);
+		src += len & ~1;
+		len &= 1;
+	}
+
+	if (len)
+		iowrite8_rep(fifo, src, len);
 }
 
 static void mstar_musb_read_fifo(struct musb_hw_ep *hw_ep, u16 len, u8 *dst)
 {
 	struct musb *musb = hw_ep->musb;
+	struct mstar_glue *glue = mstar_musb_to_glue(musb);
 	void __iomem *fifo = hw_ep->fifo;
 
 	if (unlikely(len == 0))
@@ -257,14 +422,54 @@ static void mstar_musb_read_fifo(struct musb_hw_ep *hw_ep, u16 len, u8 *dst)
 	dev_dbg(musb->controller, "%cX ep%d fifo %p count %d buf %p\n",
 			'R', hw_ep->epnum, fifo, len, dst);
 
-	for (int i = 0; i < len; i++)
-		dst[i] = readb(fifo);
+	glue->stats[hw_ep->epnum].pio_rx += len;
+
+	if (IS_ALIGNED((unsigned long)dst, 2)) {
+		ioread16_rep(fifo, dst, len >> 1);
+		dst += len & ~1;
+		len &= 1;
+	}
+
+	if (len)
+		ioread8_rep(fifo, dst, len);
 }
 
+#ifdef CONFIG_USB_INVENTRA_DMA
 /*
- * DMA has not been confirmed to work with CONFIG_USB_INVENTRA_DMA,
- * so let's not set up the dma function pointers yet.
+ * Only the gadget side asks this, host mode endpoints are not gated and
+ * take DMA for every transfer musb_host.c hands to the channel.
  */
+static int mstar_musb_dma_is_compatible(struct dma_channel *channel,
+					u16 maxpacket, void *buf, u32 length)
+{
+	/* Small transfers, i.e. control and interrupt, stay on PIO */
+	if (length < dma_threshold || length < maxpacket)
+		return false;
+
+	/* The DMA engine only does word aligned bursts */
+	if (!IS_ALIGNED((unsigned long)buf, 4))
+		return false;
+
+	return true;
+}
+
+static struct dma_controller *
+mstar_musb_dma_controller_create(struct musb *musb, void __iomem *base)
+{
+	struct dma_controller *controller;
+
+	/* The DMA interrupt is handled in mstar_musb_interrupt() */
+	controller = musbhs_dma_controller_create_noirq(musb, base);
+	if (!controller)
+		return NULL;
+
+	controller->musb = musb;
+	controller->is_compatible = mstar_musb_dma_is_compatible;
+
+	return controller;
+}
+#endif
+
 static const struct musb_platform_ops mstar_musb_ops = {
 	.quirks		= MUSB_DMA_INVENTRA,
 
@@ -288,7 +493,7 @@ static const struct musb_platform_ops mstar_musb_ops = {
 
 	/* dma */
 #ifdef CONFIG_USB_INVENTRA_DMA
-	.dma_init	= musbhs_dma_controller_create_noirq,
+	.dma_init	= mstar_musb_dma_controller_create,
 	.dma_exit	= musbhs_dma_controller_destroy,
 #endif
 };
@@ -223,6 +223,32 @@ struct reg_sequence {
 	__ret ?: __tmp; \
 })
 
+#define REGMAP_FIELD_BATCH_MAX	16
+
+/**
+ * struct regmap_field_batch - Field updates collected for a register map
+ *
+ * @map: Register map the fields belong to
+ * @num: Number of registers with pending updates
+ * @change: A write was done by a flush since the last time it was reported
+ * @updates: Pending updates, one per register with the field updates merged
+ *
+ * Lots of small field writes to the same few registers each pay for
+ * taking the regmap lock and a read/modify/write. Collecting them up
+ * and flushing them together only does that once per register and
+ * takes the lock once. Intended to live on the stack of the caller.
+ */
+struct regmap_field_batch {
+	struct regmap *map;
+	unsigned int num;
+	bool change;
+	struct {
+		unsigned int reg;
+		unsigned int mask;
+		unsigned int val;
+	} updates[REGMAP_FIELD_BATCH_MAX];
+};
+
 #ifdef CONFIG_REGMAP
 
 enum regmap_endian {
@@ -1445,6 +1471,20 @@ static inline int regmap_field_clear_bits(struct regmap_field *field,
 
 int regmap_field_test_bits(struct regmap_field *field, unsigned int bits);
 
+void regmap_field_batch_init(struct regmap_field_batch *batch,
+			     struct regmap *map);
+int regmap_field_batch_update_bits(struct regmap_field_batch *batch,
+				   struct regmap_field *field,
+				   unsigned int mask, unsigned int val);
+int regmap_field_batch_flush(struct regmap_field_batch *batch, bool *change);
+
+static inline int regmap_field_batch_write(struct regmap_field_batch *batch,
+					   struct regmap_field *field,
+					   unsigned int val)
+{
+	return regmap_field_batch_update_bits(batch, field, ~0, val);
+}
+
 static inline int
 regmap_field_force_update_bits(struct regmap_field *field,
 			       unsigned int mask, unsigned int val)
@@ -1827,6 +1867,35 @@ static inline int regmap_fields_update_bits_base(struct regmap_field *field,
 	return -EINVAL;
 }
 
+static inline void regmap_field_batch_init(struct regmap_field_batch *batch,
+					   struct regmap *map)
+{
+	WARN_ONCE(1, "regmap API is disabled");
+}
+
+static inline int regmap_field_batch_update_bits(struct regmap_field_batch *batch,
+						 struct regmap_field *field,
+						 unsigned int mask, unsigned int val)
+{
+	WARN_ONCE(1, "regmap API is disabled");
+	return -EINVAL;
+}
+
+static inline int regmap_field_batch_write(struct regmap_field_batch *batch,
+					   struct regmap_field *field,
+					   unsigned int val)
+{
+	WARN_ONCE(1, "regmap API is disabled");
+	return -EINVAL;
+}
+
+static inline int regmap_field_batch_flush(struct regmap_field_batch *batch,
+					   bool *change)
+{
+	WARN_ONCE(1, "regmap API is disabled");
+	return -EINVAL;
+}
+
 static inline int regmap_update_bits(struct regmap *map, unsigned int reg,
 				     unsigned int mask, unsigned int val)
 {
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+
+#ifndef _UAPI_DRM_MSTAR_GE_ASYNC_H
+#define _UAPI_DRM_MSTAR_GE_ASYNC_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct mstar_ge_queue_async - MSTAR_GE_IOCTL_QUEUE_ASYNC
+ * @req:	pointer to the batch, a struct mstar_ge_job_request as passed
+ *		to MSTAR_GE_IOCTL_QUEUE, req->tag is unused
+ * @out_fence:	returned sync_file fd that signals when the batch is done
+ * @pad:	must be zero
+ */
+struct mstar_ge_queue_async {
+	__u64 req;
+	__s32 out_fence;
+	__u32 pad;
+};
+
+#define MSTAR_GE_ASYNC_IOCTL_BASE	'g'
+
+#define MSTAR_GE_IOCTL_QUEUE_ASYNC \
+	_IOWR(MSTAR_GE_ASYNC_IOCTL_BASE, 0x00, struct mstar_ge_queue_async)
+
+#endif /* _UAPI_DRM_MSTAR_GE_ASYNC_H */